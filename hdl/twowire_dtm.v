@@ -83,6 +83,8 @@ twowire_dtm_io_flops io_flops_u (
 wire [3:0] mdropaddr;
 
 wire connect_now;
+wire resume_now;
+wire resumable;
 reg connected;
 
 twowire_dtm_connect_monitor connect_monitor_u (
@@ -91,7 +93,9 @@ twowire_dtm_connect_monitor connect_monitor_u (
 	.di_q        (di_q),
 	.mdropaddr   (mdropaddr),
 	.connect_now (connect_now),
-	.connected   (connected)
+	.resume_now  (resume_now),
+	.connected   (connected),
+	.resumable   (resumable)
 );
 
 assign host_connected = connected;
@@ -160,7 +164,10 @@ twowire_dtm_core #(
 	.drst_n            (drst_n),
 
 	.connected         (connected),
+	.connect_now       (connect_now),
+	.resume_now        (resume_now),
 	.disconnect_now    (disconnect_now),
+	.resumable         (resumable),
 	.mdropaddr         (mdropaddr),
 
 	.cmd               (sercom_cmd),
@@ -3,7 +3,7 @@
 // SPDX-License-Identifier CC0-1.0
 // ----------------------------------------------------------------------------
 
-// Watch DIO for a valid Connect sequence.
+// Watch DIO for a valid Connect or Resume sequence.
 
 `default_nettype none
 
@@ -15,7 +15,9 @@ module twowire_dtm_connect_monitor (
 	input  wire [3:0] mdropaddr,
 
 	output wire       connect_now,
-	input  wire       connected
+	output wire       resume_now,
+	input  wire       connected,
+	input  wire       resumable
 );
 
 localparam LFSR_TAPS = 6'h30;
@@ -41,8 +43,15 @@ end
 // - 64 bits of LFSR output, starting and ending with a `1` bit
 // - 72 ones, which can't appear in regular TWD traffic
 // - 4-bit target address, followed by its bitwise complement
+//
+// A Resume sequence is the same, except the LFSR output stops after 16 bits.
+// Bit 17 of the LFSR output is a 0, so if a resumable DTM sees a 1 there, it
+// takes it as the start of the run of ones and skips ahead to bit 66.
 
 reg [7:0] seq_ctr;
+reg       resuming;
+
+wire resume_jump = resumable && seq_ctr == 8'h11 && di_q;
 
 always @ (*) begin
 	seq_restart = 1'b0;
@@ -50,7 +59,7 @@ always @ (*) begin
 		seq_restart = 1'b1;
 	end else if (~|seq_ctr[7:6]) begin
 		// Bits 0..63: match LFSR output
-		seq_restart = di_q != lfsr_out;
+		seq_restart = di_q != lfsr_out && !resume_jump;
 	end else if (~&{seq_ctr[7], seq_ctr[3]}) begin
 		// Bits 64..135: all ones
 		seq_restart = !di_q;
@@ -65,12 +74,25 @@ always @ (posedge dck or negedge drst_n) begin
 		seq_ctr <= 8'h00;
 	end else if (seq_restart) begin
 		seq_ctr <= 8'h00;
+	end else if (resume_jump) begin
+		seq_ctr <= 8'h42;
 	end else begin
 		seq_ctr <= seq_ctr + 8'h01;
 	end
 end
 
+always @ (posedge dck or negedge drst_n) begin
+	if (!drst_n) begin
+		resuming <= 1'b0;
+	end else if (seq_restart) begin
+		resuming <= 1'b0;
+	end else if (resume_jump) begin
+		resuming <= 1'b1;
+	end
+end
+
 assign connect_now = seq_ctr == 8'h8f && di_q == !mdropaddr[0];
+assign resume_now = connect_now && resuming;
 
 endmodule
 
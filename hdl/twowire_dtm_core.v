@@ -18,7 +18,10 @@ module twowire_dtm_core #(
 	input  wire                     drst_n,
 
 	input  wire                     connected,
+	input  wire                     connect_now,
+	input  wire                     resume_now,
 	output reg                      disconnect_now,
+	output reg                      resumable,
 	output wire [3:0]               mdropaddr,
 
 	// Serial interface
@@ -102,6 +105,7 @@ wire             errflag_any = errflag_parity || errflag_busfault || errflag_bus
 wire             bus_busy;
 
 reg              csr_aincr;
+reg              csr_resumeen;
 reg              csr_ndtmreset;
 reg              csr_ndtmresetack;
 reg [3:0]        csr_mdropaddr;
@@ -154,7 +158,8 @@ always @ (*) begin
 				errflag_parity,
 				errflag_busfault,
 				errflag_busy,
-				3'h0,
+				2'h0,             // reserved
+				csr_resumeen,
 				csr_aincr,
 				3'h0,             // reserved
 				bus_busy,
@@ -275,10 +280,12 @@ wire [31:0] csr_wdata = byteswap_sreg(sreg);
 always @ (posedge dck or negedge drst_n) begin
 	if (!drst_n) begin
 		csr_aincr <= 1'b0;
+		csr_resumeen <= 1'b0;
 		csr_ndtmreset <= 1'b0;
 		csr_mdropaddr <= 4'h0;
 	end else if (write_csr) begin
 		csr_aincr <= csr_wdata[12];
+		csr_resumeen <= csr_wdata[13];
 		csr_ndtmreset <= csr_wdata[4];
 		csr_mdropaddr <= csr_wdata[3:0];
 	end
@@ -302,6 +309,20 @@ always @ (posedge dck or negedge drst_n) begin
 	end
 end
 
+// Resume: with RESUMEEN set, a parity error disconnect leaves the DTM
+// resumable, until it next connects or is told to disconnect. Resuming
+// clears EPARITY, and leaves everything else as it was.
+
+always @ (posedge dck or negedge drst_n) begin
+	if (!drst_n) begin
+		resumable <= 1'b0;
+	end else if (connect_now || disconnect_now) begin
+		resumable <= 1'b0;
+	end else if (connected && serial_parity_err && csr_resumeen) begin
+		resumable <= 1'b1;
+	end
+end
+
 wire set_errflag_busfault;
 wire set_errflag_busy;
 
@@ -312,7 +333,7 @@ always @ (posedge dck or negedge drst_n) begin
 		errflag_busfault <= 1'b0;
 	end else begin
 		errflag_parity <= (errflag_parity
-			&& !(write_csr && csr_wdata[18])) || serial_parity_err;
+			&& !(write_csr && csr_wdata[18]) && !resume_now) || serial_parity_err;
 		errflag_busfault <= (errflag_busfault
 			&& !(write_csr && csr_wdata[17])) || set_errflag_busfault;
 		errflag_busy <= (errflag_busy
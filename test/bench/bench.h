@@ -0,0 +1,44 @@
+#pragma once
+
+// Helpers shared by the benchmarks: wall-clock timing, a running checksum of
+// everything the host observed, and a one-line report. The Makefile parses
+// the report, so keep its format stable.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+
+#include "tb.h"
+
+class bench_timer {
+public:
+	bench_timer() : start(std::chrono::steady_clock::now()) {}
+	double elapsed() {
+		std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+		return d.count();
+	}
+private:
+	std::chrono::steady_clock::time_point start;
+};
+
+// FNV-1a, folded over the 8 bytes of x.
+static const uint32_t BENCH_HASH_INIT = 0x811c9dc5u;
+
+static inline uint32_t bench_hash(uint32_t h, uint64_t x) {
+	for (int i = 0; i < 8; ++i) {
+		h = (h ^ (x & 0xffu)) * 0x01000193u;
+		x >>= 8;
+	}
+	return h;
+}
+
+// Simulated cycles and checksum must be identical across backends. Only the
+// wall-clock figures are expected to differ.
+static inline void bench_report(const char *name, uint64_t cycles, double seconds, uint32_t checksum) {
+	printf("%-24s %12llu cycles %10.3f s %12.0f cycles/s checksum %08x\n",
+		name, (unsigned long long)cycles, seconds, cycles / seconds, checksum);
+}
+
+static inline void bench_report(const char *name, tb &t, double seconds, uint32_t checksum) {
+	bench_report(name, t.get_dck_cycles(), seconds, checksum);
+}
@@ -0,0 +1,41 @@
+#include "tb.h"
+#include "twd_util.h"
+#include "bench.h"
+
+// Scattered single-word reads, each a W.ADDR.R followed by R.BUFF. Mostly
+// command and address overhead rather than data.
+
+static const unsigned int N_WORDS = 10000;
+
+bus_read_response read_callback(uint64_t addr) {
+	return {
+		.data = (uint32_t)(addr * 0x9e3779b9u),
+		.delay_cycles = 0,
+		.err = false
+	};
+}
+
+int main() {
+	tb t("");
+	t.set_bus_read_callback(read_callback);
+	bench_timer timer;
+	uint32_t checksum = BENCH_HASH_INIT;
+
+	connect_target(t, 0);
+	uint32_t csr;
+	tb_assert(read_csr(t, &csr), "Bad parity on CSR read\n");
+	unsigned int asize = (csr & CSR_ASIZE_BITS) >> CSR_ASIZE_LSB;
+
+	// Fixed LCG so both backends see the same address sequence
+	uint32_t addr = 1;
+	for (unsigned int i = 0; i < N_WORDS; ++i) {
+		addr = addr * 1664525u + 1013904223u;
+		write_addr_trigger_read(t, addr, asize);
+		checksum = bench_hash(checksum, read_buf(t));
+	}
+
+	tb_assert(read_csr(t, &csr), "Bad parity on CSR read\n");
+	checksum = bench_hash(checksum, csr);
+	bench_report("bus_read_random", t, timer.elapsed(), checksum);
+	return 0;
+}
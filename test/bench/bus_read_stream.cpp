@@ -0,0 +1,38 @@
+#include "tb.h"
+#include "twd_util.h"
+#include "bench.h"
+
+// Long AINCR read burst: W.ADDR.R, back-to-back R.DATA, then R.BUFF.
+
+static const unsigned int N_WORDS = 20000;
+
+bus_read_response read_callback(uint64_t addr) {
+	return {
+		.data = (uint32_t)(addr * 0x9e3779b9u),
+		.delay_cycles = 0,
+		.err = false
+	};
+}
+
+int main() {
+	tb t("");
+	t.set_bus_read_callback(read_callback);
+	bench_timer timer;
+	uint32_t checksum = BENCH_HASH_INIT;
+
+	connect_target(t, 0);
+	uint32_t csr;
+	tb_assert(read_csr(t, &csr), "Bad parity on CSR read\n");
+	unsigned int asize = (csr & CSR_ASIZE_BITS) >> CSR_ASIZE_LSB;
+	write_csr(t, CSR_AINCR_BITS);
+
+	write_addr_trigger_read(t, 0, asize);
+	for (unsigned int i = 0; i < N_WORDS - 1; ++i)
+		checksum = bench_hash(checksum, read_data(t));
+	checksum = bench_hash(checksum, read_buf(t));
+
+	tb_assert(read_csr(t, &csr), "Bad parity on CSR read\n");
+	checksum = bench_hash(checksum, csr);
+	bench_report("bus_read_stream", t, timer.elapsed(), checksum);
+	return 0;
+}
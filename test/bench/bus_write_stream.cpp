@@ -0,0 +1,39 @@
+#include "tb.h"
+#include "twd_util.h"
+#include "bench.h"
+
+// Long AINCR write burst: one W.ADDR, then back-to-back W.DATA.
+
+static const unsigned int N_WORDS = 20000;
+
+uint32_t checksum = BENCH_HASH_INIT;
+
+bus_write_response write_callback(uint64_t addr, uint32_t data) {
+	checksum = bench_hash(checksum, addr);
+	checksum = bench_hash(checksum, data);
+	return {
+		.delay_cycles = 0,
+		.err = false
+	};
+}
+
+int main() {
+	tb t("");
+	t.set_bus_write_callback(write_callback);
+	bench_timer timer;
+
+	connect_target(t, 0);
+	uint32_t csr;
+	tb_assert(read_csr(t, &csr), "Bad parity on CSR read\n");
+	unsigned int asize = (csr & CSR_ASIZE_BITS) >> CSR_ASIZE_LSB;
+	write_csr(t, CSR_AINCR_BITS);
+
+	write_addr(t, 0, asize);
+	for (unsigned int i = 0; i < N_WORDS; ++i)
+		write_data(t, i * 0x9e3779b9u);
+
+	tb_assert(read_csr(t, &csr), "Bad parity on CSR read\n");
+	checksum = bench_hash(checksum, csr);
+	bench_report("bus_write_stream", t, timer.elapsed(), checksum);
+	return 0;
+}
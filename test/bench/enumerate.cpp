@@ -0,0 +1,76 @@
+#include <vector>
+
+#include "tb.h"
+#include "twd_util.h"
+#include "twd_multidrop.h"
+#include "bench.h"
+
+// Compare enumerate_targets() with the obvious serial loop (Connect,
+// R.IDCODE, R.CSR, Disconnect at every address) on buses with different
+// numbers of targets. Only DCK cycles spent enumerating are reported. The
+// single stream has the same DCK cost as the loop; what it saves is host
+// round trips, since it is one precomputed transfer. The sparse variant
+// probes with R.STAT first, and should be cheaper with up to 4 targets.
+
+static uint32_t hash_inventory(const twd_target_info *inventory) {
+	uint32_t h = BENCH_HASH_INIT;
+	for (unsigned int addr = 0; addr < N_MDROPADDR; ++addr) {
+		h = bench_hash(h, inventory[addr].present);
+		h = bench_hash(h, inventory[addr].idcode);
+		h = bench_hash(h, inventory[addr].csr);
+	}
+	return h;
+}
+
+static void enumerate_naive(tb &t, twd_target_info *inventory) {
+	for (unsigned int addr = 0; addr < N_MDROPADDR; ++addr) {
+		twd_target_info &info = inventory[addr];
+		info = {};
+		uint8_t idcode_bytes[4];
+		connect_target(t, addr);
+		send_command_byte(t, CMD_R_IDCODE);
+		get_bits(t, idcode_bytes, 32);
+		bool idcode_ok = check_parity_byte(t, idcode_bytes, 32);
+		bool csr_ok = read_csr(t, &info.csr);
+		send_command_byte(t, CMD_DISCONNECT);
+		info.idcode = bytes_to_ule32(idcode_bytes);
+		info.present = idcode_ok && csr_ok;
+	}
+}
+
+int main() {
+	const unsigned int target_counts[] = {1, 2, 4, 8, 16};
+	for (unsigned int n_targets : target_counts) {
+		// Spread targets across the address space
+		std::vector<uint8_t> addrs;
+		for (unsigned int i = 0; i < n_targets; ++i)
+			addrs.push_back(i * N_MDROPADDR / n_targets);
+
+		const char *variants[3] = {"naive", "stream", "sparse"};
+		uint32_t checksum[3];
+		uint64_t cycles[3];
+		for (int v = 0; v < 3; ++v) {
+			tb t("", n_targets);
+			assign_mdropaddrs(t, addrs.data(), n_targets);
+			twd_target_info inventory[N_MDROPADDR];
+			bench_timer timer;
+			uint64_t start_cycles = t.get_dck_cycles();
+			if (v == 0)
+				enumerate_naive(t, inventory);
+			else
+				enumerate_targets(t, inventory, v == 2);
+			cycles[v] = t.get_dck_cycles() - start_cycles;
+			checksum[v] = hash_inventory(inventory);
+
+			char name[64];
+			snprintf(name, sizeof(name), "enumerate_%u_%s", n_targets, variants[v]);
+			bench_report(name, cycles[v], timer.elapsed(), checksum[v]);
+		}
+		tb_assert(checksum[0] == checksum[1] && checksum[0] == checksum[2], "Inventories differ with %u targets\n",
+			n_targets);
+		tb_assert((cycles[2] < cycles[1]) == (n_targets <= 4),
+			"Sparse enumeration took %llu cycles with %u targets, single stream took %llu\n",
+			(unsigned long long)cycles[2], n_targets, (unsigned long long)cycles[1]);
+	}
+	return 0;
+}
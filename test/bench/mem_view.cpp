@@ -0,0 +1,110 @@
+#include <vector>
+
+#include "tb.h"
+#include "twd_util.h"
+#include "twd_mem.h"
+#include "bench.h"
+
+// Debugger-like memory traffic: a GUI refreshing a stack view, a handful of
+// watched variables and a memory window after every "step", plus the odd
+// variable write. Run once one word at a time through the plain twd_util.h
+// read/write path, and once through twd_mem.
+
+static const unsigned int N_REFRESH = 200;
+
+static const unsigned int MEM_SIZE = 1u << 16;
+uint32_t mem[MEM_SIZE];
+
+bus_read_response read_callback(uint64_t addr) {
+	return {
+		.data = mem[addr % MEM_SIZE],
+		.delay_cycles = 0,
+		.err = false
+	};
+}
+
+bus_write_response write_callback(uint64_t addr, uint32_t data) {
+	mem[addr % MEM_SIZE] = data;
+	return {
+		.delay_cycles = 0,
+		.err = false
+	};
+}
+
+struct view {
+	uint64_t addr;
+	unsigned int n;
+};
+
+// Stack frame, scattered globals (some adjacent), and a memory window
+static const view views[] = {
+	{0x3f00, 16},
+	{0x1004, 1}, {0x1005, 1}, {0x1010, 1}, {0x1011, 2}, {0x2200, 1},
+	{0x0800, 32}
+};
+static const unsigned int N_VIEWS = sizeof(views) / sizeof(views[0]);
+
+static void run_naive(uint32_t *checksum) {
+	tb t("");
+	t.set_bus_read_callback(read_callback);
+	t.set_bus_write_callback(write_callback);
+	bench_timer timer;
+	connect_target(t, 0);
+	uint32_t csr;
+	tb_assert(read_csr(t, &csr), "Bad parity on CSR read\n");
+	unsigned int asize = (csr & CSR_ASIZE_BITS) >> CSR_ASIZE_LSB;
+
+	for (unsigned int r = 0; r < N_REFRESH; ++r) {
+		write_addr(t, 0x1004, asize);
+		write_data(t, r);
+		for (unsigned int v = 0; v < N_VIEWS; ++v) {
+			for (unsigned int i = 0; i < views[v].n; ++i) {
+				write_addr_trigger_read(t, views[v].addr + i, asize);
+				*checksum = bench_hash(*checksum, read_buf(t));
+			}
+		}
+	}
+	bench_report("mem_view_naive", t, timer.elapsed(), *checksum);
+}
+
+static void run_cached(uint32_t *checksum) {
+	tb t("");
+	t.set_bus_read_callback(read_callback);
+	t.set_bus_write_callback(write_callback);
+	bench_timer timer;
+	connect_target(t, 0);
+	twd_mem m(t);
+
+	std::vector<uint32_t> buf[N_VIEWS];
+	twd_mem_range ranges[N_VIEWS];
+	for (unsigned int v = 0; v < N_VIEWS; ++v) {
+		buf[v].resize(views[v].n);
+		ranges[v] = {views[v].addr, views[v].n, buf[v].data()};
+	}
+	for (unsigned int r = 0; r < N_REFRESH; ++r) {
+		uint32_t data = r;
+		tb_assert(m.write(0x1004, &data, 1), "Write failed\n");
+		// After a step the target may have changed anything, so the
+		// debugger drops its cache and re-reads every view in one batch.
+		m.invalidate();
+		tb_assert(m.read_batch(ranges, N_VIEWS), "Read failed\n");
+		for (unsigned int v = 0; v < N_VIEWS; ++v)
+			for (uint32_t d : buf[v])
+				*checksum = bench_hash(*checksum, d);
+		// Views get redrawn a second time (e.g. a window resize) without
+		// the target running: all hits.
+		tb_assert(m.read_batch(ranges, N_VIEWS), "Read failed\n");
+	}
+	bench_report("mem_view_cached", t, timer.elapsed(), *checksum);
+}
+
+int main() {
+	for (unsigned int i = 0; i < MEM_SIZE; ++i)
+		mem[i] = i * 0x9e3779b9u;
+	uint32_t naive_sum = BENCH_HASH_INIT;
+	uint32_t cached_sum = BENCH_HASH_INIT;
+	run_naive(&naive_sum);
+	run_cached(&cached_sum);
+	tb_assert(naive_sum == cached_sum, "Naive and cached paths read different data\n");
+	return 0;
+}
@@ -0,0 +1,82 @@
+#include <vector>
+
+#include "tb.h"
+#include "twd_util.h"
+#include "twd_policy.h"
+#include "bench.h"
+
+// Bulk writes under a range of downstream latencies and fault rates, with
+// twd_policy pinned to each fixed strategy, and then left to adapt:
+//
+//   stat  -- R.STAT after every word
+//   defer -- batches of 64, one R.CSR per batch
+//   adapt -- twd_policy's choice
+//
+// Faults come from a fixed-seed generator, and faulted writes don't land,
+// so the final memory checksum is the same for every strategy.
+
+static const unsigned int N_WORDS = 2048;
+
+uint32_t mem[N_WORDS];
+int bus_delay;
+unsigned int fault_per_1024;
+uint32_t rng_state;
+
+static uint32_t rng() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+bus_write_response write_callback(uint64_t addr, uint32_t data) {
+	bool fault = rng() % 1024 < fault_per_1024;
+	if (!fault && addr < N_WORDS)
+		mem[addr] = data;
+	return {
+		.delay_cycles = bus_delay,
+		.err = fault
+	};
+}
+
+int main() {
+	const int delays[] = {0, 20, 40, 80, 160};
+	const unsigned int faults[] = {0, 10, 50};
+	const char *strategy_names[] = {"stat", "defer", "adapt"};
+
+	std::vector<uint32_t> data(N_WORDS);
+	for (unsigned int i = 0; i < N_WORDS; ++i)
+		data[i] = i * 0x9e3779b9u;
+
+	for (int delay : delays) {
+		for (unsigned int fault : faults) {
+			for (int strategy = 0; strategy < 3; ++strategy) {
+				bus_delay = delay;
+				fault_per_1024 = fault;
+				rng_state = 1;
+				for (unsigned int i = 0; i < N_WORDS; ++i)
+					mem[i] = 0;
+
+				tb t("");
+				t.set_bus_write_callback(write_callback);
+				connect_target(t, 0);
+				twd_policy p(t, 64, 1000);
+				if (strategy == 0)
+					p.pin(POLL_STAT, 1);
+				else if (strategy == 1)
+					p.pin(POLL_DEFERRED, 64);
+
+				bench_timer timer;
+				tb_assert(p.write(0, data.data(), N_WORDS), "Write failed\n");
+				uint32_t checksum = BENCH_HASH_INIT;
+				for (unsigned int i = 0; i < N_WORDS; ++i)
+					checksum = bench_hash(checksum, mem[i]);
+
+				char name[64];
+				snprintf(name, sizeof(name), "policy_d%d_f%u_%s", delay, fault, strategy_names[strategy]);
+				bench_report(name, p.stats.dck_cycles, timer.elapsed(), checksum);
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,79 @@
+#include "tb.h"
+#include "twd_util.h"
+#include "bench.h"
+
+// Cost of getting back to work after a parity error disconnect: the full
+// recommended connection sequence (tristate clocks, Disconnect, Connect,
+// then check and clear EPARITY), versus Resume followed by one R.STAT.
+//
+// Traffic is AINCR write bursts, each ending with a corrupted command. Only
+// the DCK cycles spent recovering are reported. Both paths must leave the
+// same data on the bus, since ADDR survives either way.
+
+static const unsigned int N_ERRORS = 200;
+static const unsigned int BURST_WORDS = 16;
+
+uint32_t checksum;
+
+bus_write_response write_callback(uint64_t addr, uint32_t data) {
+	checksum = bench_hash(checksum, addr);
+	checksum = bench_hash(checksum, data);
+	return {
+		.delay_cycles = 0,
+		.err = false
+	};
+}
+
+static void send_bad_command(tb &t) {
+	uint8_t bad_cmd_byte =
+		1u << 7 |
+		CMD_W_DATA << 3 |
+		0u << 2; // Parity fail
+	put_bits(t, &bad_cmd_byte, 8);
+}
+
+int main() {
+	for (int resume = 0; resume < 2; ++resume) {
+		checksum = BENCH_HASH_INIT;
+		tb t("");
+		t.set_bus_write_callback(write_callback);
+		connect_target(t, 0);
+		uint32_t csr;
+		tb_assert(read_csr(t, &csr), "Bad parity on CSR read\n");
+		unsigned int asize = (csr & CSR_ASIZE_BITS) >> CSR_ASIZE_LSB;
+		const uint32_t ctrl = CSR_AINCR_BITS | (resume ? CSR_RESUMEEN_BITS : 0);
+		write_csr(t, ctrl);
+		write_addr(t, 0, asize);
+
+		bench_timer timer;
+		uint64_t recovery_cycles = 0;
+		for (unsigned int i = 0; i < N_ERRORS; ++i) {
+			for (unsigned int j = 0; j < BURST_WORDS; ++j)
+				write_data(t, (i * BURST_WORDS + j) * 0x9e3779b9u);
+			send_bad_command(t);
+			tb_assert(!t.get_stat_connected(), "Parity error didn't disconnect\n");
+
+			uint64_t start = t.get_dck_cycles();
+			if (resume) {
+				uint8_t stat;
+				resume_target(t, 0);
+				tb_assert(read_stat(t, &stat), "Bad parity on R.STAT after resume\n");
+				tb_assert(!(stat & STAT_EPARITY_BITS), "EPARITY set after resume\n");
+			} else {
+				hiz_clocks(t, 80);
+				send_command_byte(t, CMD_DISCONNECT);
+				connect_target(t, 0);
+				tb_assert(read_csr(t, &csr), "Bad parity on CSR read after reconnect\n");
+				tb_assert(csr & CSR_EPARITY_BITS, "EPARITY not set after reconnect\n");
+				write_csr(t, ctrl | CSR_EPARITY_BITS);
+			}
+			recovery_cycles += t.get_dck_cycles() - start;
+			tb_assert(t.get_stat_connected(), "Failed to recover\n");
+		}
+		tb_assert(read_csr(t, &csr), "Bad parity on CSR read\n");
+		tb_assert(!(csr & (CSR_EPARITY_BITS | CSR_EBUSFAULT_BITS | CSR_EBUSY_BITS)), "Errors at end: %08x\n", csr);
+		checksum = bench_hash(checksum, read_addr(t, asize));
+		bench_report(resume ? "recover_resume" : "recover_reconnect", recovery_cycles, timer.elapsed(), checksum);
+	}
+	return 0;
+}
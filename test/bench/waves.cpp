@@ -0,0 +1,61 @@
+#include <sys/stat.h>
+
+#include "tb.h"
+#include "twd_util.h"
+#include "bench.h"
+
+// Same traffic as bus_write_stream, but with waveform dumping enabled, to
+// measure the cost of the waveform sink. Build with WAVES=vcd and WAVES=bin
+// to compare formats. The size of the waveform file goes to stderr, so the
+// report line stays comparable between backends.
+
+static const unsigned int N_WORDS = 5000;
+
+uint32_t checksum = BENCH_HASH_INIT;
+
+bus_write_response write_callback(uint64_t addr, uint32_t data) {
+	checksum = bench_hash(checksum, addr);
+	checksum = bench_hash(checksum, data);
+	return {
+		.delay_cycles = 0,
+		.err = false
+	};
+}
+
+int main() {
+	// tb replaces the extension to match the format it actually writes
+	const char *exts[] = {".vcd", ".twv", ".fst"};
+	for (const char *ext : exts)
+		remove((std::string("bench_waves") + ext).c_str());
+
+	uint64_t cycles;
+	bench_timer timer;
+	{
+		tb t("bench_waves.vcd");
+		t.set_bus_write_callback(write_callback);
+
+		connect_target(t, 0);
+		uint32_t csr;
+		tb_assert(read_csr(t, &csr), "Bad parity on CSR read\n");
+		unsigned int asize = (csr & CSR_ASIZE_BITS) >> CSR_ASIZE_LSB;
+		write_csr(t, CSR_AINCR_BITS);
+
+		write_addr(t, 0, asize);
+		for (unsigned int i = 0; i < N_WORDS; ++i)
+			write_data(t, i * 0x9e3779b9u);
+
+		tb_assert(read_csr(t, &csr), "Bad parity on CSR read\n");
+		checksum = bench_hash(checksum, csr);
+		cycles = t.get_dck_cycles();
+		// Include draining and closing the waveform file in the timing
+	}
+	bench_report("waves", cycles, timer.elapsed(), checksum);
+
+	for (const char *ext : exts) {
+		struct stat st;
+		std::string name = std::string("bench_waves") + ext;
+		if (stat(name.c_str(), &st) == 0)
+			fprintf(stderr, "%s: %lld bytes\n", name.c_str(), (long long)st.st_size);
+	}
+	return 0;
+}
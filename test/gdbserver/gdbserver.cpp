@@ -0,0 +1,443 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "tb.h"
+#include "twd_util.h"
+#include "twd_mem.h"
+
+// Minimal GDB remote-protocol stub, serving the downstream bus of the
+// simulated DTM as target memory on a local TCP port. Only the memory
+// packets (m, M, X) do real work. There is no CPU behind the DTM, so
+// register and execution packets get canned replies.
+//
+// GDB uses byte addresses, and the downstream bus uses word addresses, so
+// accesses are widened to whole words. Partial writes are read-modify-write.
+//
+// Usage: gdbserver [-p port] [-w waves.vcd] [-n]
+//
+//   -n  Naive mode: skip twd_mem and access one word at a time through
+//       write_addr_trigger_read()/read_buf() and write_addr()/write_data().
+//       Useful for measuring what the cache and burst coalescing buy.
+//
+// Then in GDB: target remote localhost:3333
+
+// Registers in the canned 'g' reply: 32 GPRs plus PC, i.e. shaped like RV32.
+static const int N_FAKE_REGS = 33;
+
+// Advertised in qSupported. Bounds the length of memory accesses: m replies
+// and M payloads take two hex digits per byte.
+static const size_t PACKET_SIZE = 0x4000;
+
+// ----------------------------------------------------------------------------
+// Downstream memory model. Sparse, and unwritten words read as zero.
+
+std::unordered_map<uint64_t, uint32_t> mem;
+
+bus_read_response read_callback(uint64_t addr) {
+	auto it = mem.find(addr);
+	return {
+		.data = it == mem.end() ? 0u : it->second,
+		.delay_cycles = 0,
+		.err = false
+	};
+}
+
+bus_write_response write_callback(uint64_t addr, uint32_t data) {
+	mem[addr] = data;
+	return {
+		.delay_cycles = 0,
+		.err = false
+	};
+}
+
+// ----------------------------------------------------------------------------
+// Memory access through the DTM
+
+struct packet_stats {
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t dck_cycles;
+};
+
+static tb *dtm;
+static twd_mem *cached;
+static unsigned int asize;
+static uint32_t csr_ctrl;
+static packet_stats read_stats;
+static packet_stats write_stats;
+
+static bool naive_check_errors() {
+	uint32_t csr;
+	return check_csr_errors(*dtm, &csr_ctrl, &csr);
+}
+
+static bool read_words(uint64_t addr, uint32_t *data, size_t n) {
+	if (cached)
+		return cached->read(addr, data, n);
+	for (size_t i = 0; i < n; ++i) {
+		write_addr_trigger_read(*dtm, addr + i, asize);
+		data[i] = read_buf(*dtm);
+	}
+	return naive_check_errors();
+}
+
+static bool write_words(uint64_t addr, const uint32_t *data, size_t n) {
+	if (cached)
+		return cached->write(addr, data, n);
+	for (size_t i = 0; i < n; ++i) {
+		write_addr(*dtm, addr + i, asize);
+		write_data(*dtm, data[i]);
+	}
+	return naive_check_errors();
+}
+
+static bool read_bytes(uint64_t addr, uint8_t *buf, size_t len) {
+	if (len == 0)
+		return true;
+	uint64_t first = addr >> 2;
+	uint64_t last = (addr + len - 1) >> 2;
+	std::vector<uint32_t> words(last - first + 1);
+	if (!read_words(first, words.data(), words.size()))
+		return false;
+	for (size_t i = 0; i < len; ++i)
+		buf[i] = words[((addr + i) >> 2) - first] >> 8 * ((addr + i) & 0x3u);
+	return true;
+}
+
+static bool write_bytes(uint64_t addr, const uint8_t *buf, size_t len) {
+	if (len == 0)
+		return true;
+	uint64_t first = addr >> 2;
+	uint64_t last = (addr + len - 1) >> 2;
+	std::vector<uint32_t> words(last - first + 1);
+	// Fetch the old contents of partially-written words at either end
+	if (addr & 0x3u && !read_words(first, &words[0], 1))
+		return false;
+	if ((addr + len) & 0x3u && (last != first || !(addr & 0x3u)) && !read_words(last, &words[last - first], 1))
+		return false;
+	for (size_t i = 0; i < len; ++i) {
+		uint32_t &w = words[((addr + i) >> 2) - first];
+		unsigned int shamt = 8 * ((addr + i) & 0x3u);
+		w = (w & ~(0xffu << shamt)) | (uint32_t)buf[i] << shamt;
+	}
+	return write_words(first, words.data(), words.size());
+}
+
+// ----------------------------------------------------------------------------
+// Remote serial protocol framing
+
+class gdb_conn {
+public:
+	gdb_conn(int fd_) : fd(fd_), rx_pos(0), rx_len(0) {}
+
+	// Returns false when the connection closes. An interrupt request (0x03)
+	// is returned as a single-character packet.
+	bool recv_packet(std::string &pkt) {
+		int c;
+		while (true) {
+			do {
+				if ((c = getc()) < 0)
+					return false;
+				if (c == 0x03) {
+					pkt = "\x03";
+					return true;
+				}
+			} while (c != '$');
+			pkt.clear();
+			uint8_t sum = 0;
+			while ((c = getc()) >= 0 && c != '#') {
+				sum += c;
+				pkt.push_back(c);
+			}
+			int hi = getc();
+			int lo = getc();
+			if (c < 0 || hi < 0 || lo < 0)
+				return false;
+			if ((hexval(hi) << 4 | hexval(lo)) == sum) {
+				send_raw("+");
+				return true;
+			}
+			send_raw("-");
+		}
+	}
+
+	void send_packet(const std::string &payload) {
+		static const char hexdigits[] = "0123456789abcdef";
+		uint8_t sum = 0;
+		for (char c : payload)
+			sum += c;
+		std::string frame = "$" + payload + "#" + hexdigits[sum >> 4] + hexdigits[sum & 0xf];
+		int ack;
+		do {
+			send_raw(frame);
+			ack = getc();
+		} while (ack == '-');
+	}
+
+	static int hexval(int c) {
+		if (c >= '0' && c <= '9')
+			return c - '0';
+		if (c >= 'a' && c <= 'f')
+			return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F')
+			return c - 'A' + 10;
+		return -1;
+	}
+
+private:
+	int fd;
+	uint8_t rx_buf[4096];
+	size_t rx_pos;
+	size_t rx_len;
+
+	int getc() {
+		if (rx_pos == rx_len) {
+			ssize_t n = recv(fd, rx_buf, sizeof(rx_buf), 0);
+			if (n <= 0)
+				return -1;
+			rx_pos = 0;
+			rx_len = n;
+		}
+		return rx_buf[rx_pos++];
+	}
+
+	void send_raw(const std::string &s) {
+		size_t done = 0;
+		while (done < s.size()) {
+			ssize_t n = send(fd, s.data() + done, s.size() - done, 0);
+			if (n <= 0)
+				return;
+			done += n;
+		}
+	}
+};
+
+// ----------------------------------------------------------------------------
+// Packet handling
+
+// Fails if len exceeds max_len, or the access wraps past the top of memory.
+static bool parse_addr_len(const std::string &pkt, size_t start, size_t max_len, uint64_t *addr, size_t *len,
+	size_t *end) {
+	char *p;
+	const char *s = pkt.c_str() + start;
+	*addr = strtoull(s, &p, 16);
+	if (*p != ',')
+		return false;
+	uint64_t l = strtoull(p + 1, &p, 16);
+	if (l > max_len || (l && *addr + (l - 1) < *addr))
+		return false;
+	*len = l;
+	*end = p - pkt.c_str();
+	return true;
+}
+
+static std::string handle_mem_read(const std::string &pkt) {
+	static const char hexdigits[] = "0123456789abcdef";
+	uint64_t addr;
+	size_t len, end;
+	if (!parse_addr_len(pkt, 1, PACKET_SIZE / 2, &addr, &len, &end))
+		return "E01";
+	std::vector<uint8_t> buf(len);
+	uint64_t start_cycles = dtm->get_dck_cycles();
+	bool ok = read_bytes(addr, buf.data(), len);
+	++read_stats.packets;
+	read_stats.bytes += len;
+	read_stats.dck_cycles += dtm->get_dck_cycles() - start_cycles;
+	if (!ok)
+		return "E03";
+	std::string reply;
+	for (uint8_t b : buf) {
+		reply.push_back(hexdigits[b >> 4]);
+		reply.push_back(hexdigits[b & 0xf]);
+	}
+	return reply;
+}
+
+static std::string handle_mem_write(const std::string &pkt, bool binary) {
+	uint64_t addr;
+	size_t len, end;
+	if (!parse_addr_len(pkt, 1, binary ? PACKET_SIZE : PACKET_SIZE / 2, &addr, &len, &end) ||
+		end >= pkt.size() || pkt[end] != ':')
+		return "E01";
+	std::vector<uint8_t> buf;
+	for (size_t i = end + 1; i < pkt.size() && buf.size() < len; ++i) {
+		if (binary) {
+			// 0x7d escapes the following character, XORed with 0x20
+			if (pkt[i] == 0x7d && i + 1 < pkt.size())
+				buf.push_back(pkt[++i] ^ 0x20);
+			else
+				buf.push_back(pkt[i]);
+		} else {
+			if (i + 1 >= pkt.size())
+				return "E01";
+			int hi = gdb_conn::hexval(pkt[i]);
+			int lo = gdb_conn::hexval(pkt[++i]);
+			if (hi < 0 || lo < 0)
+				return "E01";
+			buf.push_back(hi << 4 | lo);
+		}
+	}
+	if (buf.size() != len)
+		return "E01";
+	uint64_t start_cycles = dtm->get_dck_cycles();
+	bool ok = write_bytes(addr, buf.data(), len);
+	++write_stats.packets;
+	write_stats.bytes += len;
+	write_stats.dck_cycles += dtm->get_dck_cycles() - start_cycles;
+	return ok ? "OK" : "E03";
+}
+
+static void print_stats() {
+	const packet_stats *s[2] = {&read_stats, &write_stats};
+	const char *name[2] = {"read", "write"};
+	for (int i = 0; i < 2; ++i) {
+		printf("%-5s packets: %8llu, bytes: %10llu, DCK cycles: %12llu (%.1f per packet)\n",
+			name[i], (unsigned long long)s[i]->packets, (unsigned long long)s[i]->bytes,
+			(unsigned long long)s[i]->dck_cycles,
+			s[i]->packets ? (double)s[i]->dck_cycles / s[i]->packets : 0.0);
+	}
+	if (cached) {
+		twd_mem_stats &m = cached->stats;
+		printf("cache: %llu/%llu words hit, %llu words fetched in %llu bursts, %llu words written in %llu bursts, %llu errors\n",
+			(unsigned long long)m.words_hit, (unsigned long long)m.words_requested,
+			(unsigned long long)m.words_fetched, (unsigned long long)m.read_bursts,
+			(unsigned long long)m.words_written, (unsigned long long)m.write_bursts,
+			(unsigned long long)m.errors);
+	}
+	fflush(stdout);
+}
+
+// Returns false if the client asked us to exit.
+static bool serve(int fd) {
+	gdb_conn conn(fd);
+	std::string pkt;
+	while (conn.recv_packet(pkt)) {
+		if (pkt.empty()) {
+			conn.send_packet("");
+			continue;
+		}
+		switch (pkt[0]) {
+		case 0x03:
+			conn.send_packet("S02");
+			break;
+		case '?':
+			conn.send_packet("S05");
+			break;
+		case 'g':
+			conn.send_packet(std::string(8 * N_FAKE_REGS, '0'));
+			break;
+		case 'p':
+			conn.send_packet("00000000");
+			break;
+		case 'G':
+		case 'P':
+		case 'H':
+			conn.send_packet("OK");
+			break;
+		case 'm':
+			conn.send_packet(handle_mem_read(pkt));
+			break;
+		case 'M':
+			conn.send_packet(handle_mem_write(pkt, false));
+			break;
+		case 'X':
+			conn.send_packet(handle_mem_write(pkt, true));
+			break;
+		case 'c':
+		case 's':
+			// A real target would have run, so nothing cached is current
+			if (cached)
+				cached->invalidate();
+			conn.send_packet("S05");
+			break;
+		case 'D':
+			conn.send_packet("OK");
+			return true;
+		case 'k':
+			return false;
+		case 'q':
+			if (pkt.compare(0, 10, "qSupported") == 0) {
+				char reply[32];
+				snprintf(reply, sizeof(reply), "PacketSize=%zx", PACKET_SIZE);
+				conn.send_packet(reply);
+			} else if (pkt == "qAttached") {
+				conn.send_packet("1");
+			} else {
+				conn.send_packet("");
+			}
+			break;
+		default:
+			conn.send_packet("");
+			break;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	int port = 3333;
+	std::string vcdfile;
+	bool naive = false;
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+			port = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+			vcdfile = argv[++i];
+		} else if (!strcmp(argv[i], "-n")) {
+			naive = true;
+		} else {
+			fprintf(stderr, "Usage: %s [-p port] [-w waves.vcd] [-n]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	tb t(vcdfile);
+	t.set_bus_read_callback(read_callback);
+	t.set_bus_write_callback(write_callback);
+	dtm = &t;
+
+	connect_target(t, 0);
+	uint32_t csr;
+	tb_assert(read_csr(t, &csr), "Bad parity on CSR read\n");
+	asize = (csr & CSR_ASIZE_BITS) >> CSR_ASIZE_LSB;
+	csr_ctrl = csr & CSR_CTRL_BITS;
+	// Naive mode leaves the CSR as Connect left it, with AINCR clear
+	if (!naive)
+		cached = new twd_mem(t);
+
+	int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	tb_assert(listen_fd >= 0, "Failed to create socket\n");
+	int one = 1;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	sockaddr_in sa = {};
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	tb_assert(bind(listen_fd, (sockaddr*)&sa, sizeof(sa)) == 0, "Failed to bind port %d\n", port);
+	tb_assert(listen(listen_fd, 1) == 0, "Failed to listen\n");
+	printf("Listening on localhost:%d (%s)\n", port, naive ? "naive" : "cached");
+	fflush(stdout);
+
+	bool keep_going = true;
+	while (keep_going) {
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0)
+			continue;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		keep_going = serve(fd);
+		close(fd);
+		print_stats();
+	}
+	close(listen_fd);
+	return 0;
+}
@@ -2,9 +2,10 @@
 
 #include <string>
 #include <cstdint>
-#include <fstream>
-#include <cxxrtl/cxxrtl.h>
-#include <cxxrtl/cxxrtl_vcd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+#include <vector>
 
 struct bus_read_response {
 	uint32_t data;
@@ -21,27 +22,55 @@ typedef bus_read_response (*bus_read_callback)(uint64_t addr);
 
 typedef bus_write_response (*bus_write_callback)(uint64_t addr, uint32_t data);
 
+// Simulator-specific state. Defined by whichever backend tb.cpp was built
+// with (see test/tb/Makefile), so nothing here depends on the simulator.
+struct tb_dut;
+
+// Run log writer, see test/tb/twr.h
+class twr_writer;
+
 class tb {
 public:
-	tb(std::string vcdfile);
+	// Pass an empty filename to disable waveform dumping. With more than one
+	// instance, all DTMs share DCK and DIO (multidrop) and all of their
+	// downstream buses are served by the same callbacks.
+	//
+	// If the TWD_RECORD environment variable is set, every input and bus
+	// response is logged to that file, for replay by test/replay/. The n-th
+	// tb after the first in a process logs to "name.n.ext" instead.
+	tb(std::string vcdfile, unsigned int n_instances = 1);
+	~tb();
 	void set_bus_read_callback(bus_read_callback cb);
 	void set_bus_write_callback(bus_write_callback cb);
 
 	void set_dck(bool dck);
 	void set_di(bool di);
 	bool get_do();
-	bool get_stat_connected();
+	bool get_stat_connected(unsigned int instance = 0);
+	// Hold one instance's DTM in reset, e.g. for multidrop address assignment
+	void set_reset(unsigned int instance, bool asserted);
 	void step();
+
+	// Number of DCK rising edges since construction
+	uint64_t get_dck_cycles();
 private:
-	int vcd_sample;
+	struct bus_state {
+		uint64_t addr;
+		uint32_t wdata;
+		bool wen;
+		bool ren;
+		bus_read_response last_read_response;
+		bus_write_response last_write_response;
+	};
+
+	uint64_t vcd_sample;
+	uint64_t dck_cycles;
 	bool dck_prev;
 	bus_read_callback read_callback;
-	bus_read_response last_read_response;
 	bus_write_callback write_callback;
-	bus_write_response last_write_response;
-	std::ofstream waves_fd;
-	cxxrtl::vcd_writer vcd;
-	cxxrtl::module *dut;
+	std::vector<bus_state> bus;
+	tb_dut *dut;
+	twr_writer *recorder;
 };
 
 #define tb_assert(cond, ...) if (!(cond)) {printf(__VA_ARGS__); exit(-1);}
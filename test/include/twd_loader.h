@@ -0,0 +1,416 @@
+#pragma once
+
+// Differential memory-image loading: reloading a mostly unchanged image only
+// sends the pages which changed since the last load.
+//
+// - twd_image maps an ELF file (the file contents of its PT_LOAD segments, at
+//   their physical addresses) or a flat binary (at a given base address).
+// - twd_loader splits the image into pages and hashes each one. It keeps a
+//   manifest of the hashes of the pages loaded into each target, in a file
+//   named after the target's IDCODE and multidrop address. A load replaces
+//   the entries its pages overlap, and keeps the rest, so images at
+//   different addresses can be loaded in turn. Pages whose hash matches the
+//   manifest are skipped. Changed pages go out as W.ADDR + AINCR
+//   W.DATA bursts, and W.ADDR is skipped between adjacent pages.
+// - Afterward, a few words of every page are read back: two from each written
+//   page, and one from each skipped page, so target memory that changed
+//   behind the manifest's back (a reset, or the program scribbling on its own
+//   data) is likely noticed. A skipped page that doesn't match is written
+//   after all. A written page that doesn't match fails the load.
+// - The words sampled depend on a load counter, kept in the manifest, so
+//   successive reloads check different words.
+//
+// Image addresses are byte addresses, and the target is little-endian.
+// Segments must start word-aligned; a partial last word is padded with
+// zeroes. The DTM must already be connected when the twd_loader is
+// constructed.
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <iterator>
+
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tb.h"
+#include "twd_util.h"
+
+struct twd_image_segment {
+	uint64_t addr;              // Byte address
+	const uint8_t *data;
+	size_t size;                // Bytes
+};
+
+class twd_image {
+public:
+	twd_image() : map(nullptr), map_size(0) {}
+	~twd_image() {
+		unmap();
+	}
+	twd_image(const twd_image&) = delete;
+	twd_image &operator=(const twd_image&) = delete;
+
+	// An ELF file is recognised by its magic. Anything else is a flat binary,
+	// loaded at flat_base. Returns false if the file can't be read, or the ELF
+	// is malformed or has a misaligned segment.
+	bool open(const std::string &filename, uint64_t flat_base = 0) {
+		unmap();
+		segments.clear();
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0) {
+			::close(fd);
+			return false;
+		}
+		map_size = st.st_size;
+		void *p = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED) {
+			map_size = 0;
+			return false;
+		}
+		map = (const uint8_t*)p;
+
+		bool ok;
+		if (map_size >= EI_NIDENT && !memcmp(map, ELFMAG, SELFMAG))
+			ok = map[EI_CLASS] == ELFCLASS64 ? parse_elf<Elf64_Ehdr, Elf64_Phdr>() : parse_elf<Elf32_Ehdr, Elf32_Phdr>();
+		else
+			ok = add_segment(flat_base, map, map_size);
+		if (!ok) {
+			unmap();
+			segments.clear();
+		}
+		return ok;
+	}
+
+	std::vector<twd_image_segment> segments;
+
+private:
+	const uint8_t *map;
+	size_t map_size;
+
+	void unmap() {
+		if (map)
+			munmap((void*)map, map_size);
+		map = nullptr;
+		map_size = 0;
+	}
+
+	bool add_segment(uint64_t addr, const uint8_t *data, size_t size) {
+		if (addr % 4)
+			return false;
+		if (size)
+			segments.push_back({addr, data, size});
+		return true;
+	}
+
+	template <typename Ehdr, typename Phdr>
+	bool parse_elf() {
+		if (map[EI_CLASS] != (sizeof(Ehdr) == sizeof(Elf64_Ehdr) ? ELFCLASS64 : ELFCLASS32) ||
+			map[EI_DATA] != ELFDATA2LSB || map_size < sizeof(Ehdr))
+			return false;
+		Ehdr eh;
+		memcpy(&eh, map, sizeof(eh));
+		if (eh.e_phentsize != sizeof(Phdr) || eh.e_phoff > map_size ||
+			(map_size - eh.e_phoff) / sizeof(Phdr) < eh.e_phnum)
+			return false;
+		for (unsigned int i = 0; i < eh.e_phnum; ++i) {
+			Phdr ph;
+			memcpy(&ph, map + eh.e_phoff + i * sizeof(Phdr), sizeof(ph));
+			if (ph.p_type != PT_LOAD)
+				continue;
+			if (ph.p_offset > map_size || map_size - ph.p_offset < ph.p_filesz)
+				return false;
+			// Like most loaders, leave .bss to the program's startup code
+			if (!add_segment(ph.p_paddr, map + ph.p_offset, ph.p_filesz))
+				return false;
+		}
+		return true;
+	}
+};
+
+struct twd_load_stats {
+	uint64_t bytes_total;
+	uint64_t bytes_written;     // Including stale pages rewritten after readback
+	uint64_t bytes_skipped;
+	uint64_t pages_total;
+	uint64_t pages_written;
+	uint64_t pages_stale;       // Skipped by hash, but failed readback
+	uint64_t words_verified;
+	uint64_t dck_cycles;        // For the whole load, including readback
+	uint64_t dck_cycles_full;   // Estimate for writing and checking every page
+};
+
+class twd_loader {
+public:
+	// page_words must be a power of two. The manifest directory must exist.
+	twd_loader(tb &t_, const std::string &manifest_dir = ".", unsigned int page_words_ = 256) :
+		t(t_), page_words(page_words_) {
+		stats = {};
+		uint32_t csr;
+		tb_assert(read_csr(t, &csr), "twd_loader: bad parity on CSR read\n");
+		asize = (csr & CSR_ASIZE_BITS) >> CSR_ASIZE_LSB;
+		// Only set AINCR: leave the other control fields as the host left them
+		csr_ctrl = (csr & CSR_CTRL_BITS) | CSR_AINCR_BITS;
+		write_csr(t, csr_ctrl);
+
+		uint8_t idcode_bytes[4];
+		send_command_byte(t, CMD_R_IDCODE);
+		get_bits(t, idcode_bytes, 32);
+		tb_assert(check_parity_byte(t, idcode_bytes, 32), "twd_loader: bad parity on IDCODE read\n");
+		char name[64];
+		snprintf(name, sizeof(name), "/twd_manifest_%08x_%x.txt", bytes_to_ule32(idcode_bytes),
+			(csr & CSR_MDROPADDR_BITS) >> CSR_MDROPADDR_LSB);
+		manifest_path = manifest_dir + name;
+	}
+
+	// Load the image into target memory. With force_full, ignore the manifest
+	// and write every page. On failure the image's pages are dropped from the
+	// manifest, so the next load writes them all.
+	bool load(const twd_image &img, bool force_full = false) {
+		uint64_t start_cycles = t.get_dck_cycles();
+		stats = {};
+		std::vector<page> pages = split(img);
+		manifest_map manifest;
+		uint64_t generation = 0;
+		read_manifest(manifest, generation);
+		++generation;
+
+		uint64_t next_addr = ~0ull;
+		for (page &p : pages) {
+			auto it = manifest.find(std::make_pair(p.addr, p.words.size()));
+			p.dirty = force_full || it == manifest.end() || it->second != p.hash;
+			stats.bytes_total += p.bytes;
+			++stats.pages_total;
+			// Same traffic as a load with every page dirty
+			if (p.addr != next_addr)
+				stats.dck_cycles_full += cost_addr();
+			next_addr = p.addr + p.words.size();
+			stats.dck_cycles_full += p.words.size() * COST_WORD;
+			stats.dck_cycles_full += n_samples(p, true) * (cost_addr() + COST_WORD);
+		}
+		stats.dck_cycles_full += 2 * COST_WORD;
+
+		// Rewrite any stale pages found by the readback, and check them again.
+		// A page can't go stale twice, so this runs at most twice.
+		bool ok = write_dirty(pages);
+		bool any_stale = true;
+		while (ok && any_stale) {
+			ok = verify(pages, generation, any_stale);
+			if (ok && any_stale)
+				ok = write_dirty(pages);
+		}
+
+		for (page &p : pages) {
+			if (p.written) {
+				stats.bytes_written += p.bytes;
+				++stats.pages_written;
+			}
+		}
+		stats.bytes_skipped = stats.bytes_total - stats.bytes_written;
+		drop_overlaps(manifest, pages);
+		if (ok) {
+			for (const page &p : pages)
+				manifest[std::make_pair(p.addr, p.words.size())] = p.hash;
+		}
+		if (!write_manifest(manifest, generation)) {
+			remove(manifest_path.c_str());
+			ok = false;
+		}
+		stats.dck_cycles = t.get_dck_cycles() - start_cycles;
+		return ok;
+	}
+
+	const std::string &get_manifest_path() {
+		return manifest_path;
+	}
+
+	twd_load_stats stats;
+
+private:
+	// Serial cost of W.DATA, R.BUFF or R.CSR, in DCK cycles
+	static const unsigned int COST_WORD = 8 + 32 + 4;
+	// Words read back from each written or skipped page
+	static const unsigned int SAMPLES_WRITTEN = 2;
+	static const unsigned int SAMPLES_SKIPPED = 1;
+
+	// (word address, word count) -> hash
+	typedef std::map<std::pair<uint64_t, size_t>, uint64_t> manifest_map;
+
+	struct page {
+		uint64_t addr;              // Word address
+		std::vector<uint32_t> words;
+		size_t bytes;               // Image bytes, before padding
+		uint64_t hash;
+		bool dirty;
+		bool written;
+		bool verified;
+	};
+
+	tb &t;
+	std::string manifest_path;
+	unsigned int page_words;
+	unsigned int asize;
+	uint32_t csr_ctrl;
+
+	unsigned int cost_addr() {
+		return 8 + 8 * (asize + 1) + 4;
+	}
+
+	static size_t n_samples(const page &p, bool dirty) {
+		return std::min<size_t>(dirty ? SAMPLES_WRITTEN : SAMPLES_SKIPPED, p.words.size());
+	}
+
+	// FNV-1a, 64-bit
+	static uint64_t hash_words(uint64_t addr, const std::vector<uint32_t> &words) {
+		uint64_t h = 0xcbf29ce484222325ull;
+		auto mix = [&](uint64_t x, int n_bytes) {
+			for (int i = 0; i < n_bytes; ++i) {
+				h ^= (x >> 8 * i) & 0xffu;
+				h *= 0x100000001b3ull;
+			}
+		};
+		mix(addr, 8);
+		for (uint32_t w : words)
+			mix(w, 4);
+		return h;
+	}
+
+	std::vector<page> split(const twd_image &img) {
+		std::vector<page> pages;
+		for (const twd_image_segment &seg : img.segments) {
+			size_t offs = 0;
+			while (offs < seg.size) {
+				page p;
+				p.addr = (seg.addr + offs) / 4;
+				// Pages are aligned in target memory, not in the segment
+				size_t words = page_words - (p.addr & (page_words - 1));
+				p.bytes = std::min<size_t>(words * 4, seg.size - offs);
+				p.words.assign((p.bytes + 3) / 4, 0);
+				for (size_t i = 0; i < p.bytes; ++i)
+					p.words[i / 4] |= (uint32_t)seg.data[offs + i] << 8 * (i % 4);
+				p.hash = hash_words(p.addr, p.words);
+				p.dirty = true;
+				p.written = false;
+				p.verified = false;
+				offs += p.bytes;
+				pages.push_back(std::move(p));
+			}
+		}
+		return pages;
+	}
+
+	bool check_errors() {
+		uint32_t csr;
+		return check_csr_errors(t, &csr_ctrl, &csr);
+	}
+
+	bool write_dirty(std::vector<page> &pages) {
+		bool any = false;
+		uint64_t next_addr = 0;
+		bool addr_known = false;
+		for (page &p : pages) {
+			if (!p.dirty)
+				continue;
+			if (!addr_known || next_addr != p.addr)
+				write_addr(t, p.addr, asize);
+			for (uint32_t w : p.words)
+				write_data(t, w);
+			next_addr = p.addr + p.words.size();
+			addr_known = true;
+			p.written = true;
+			any = true;
+		}
+		return !any || check_errors();
+	}
+
+	// Read back a few words of each page not yet verified, at offsets which
+	// depend on the load counter. Pages which were skipped but don't match
+	// become dirty. Returns false on a bus error, or if a page we wrote
+	// doesn't match.
+	bool verify(std::vector<page> &pages, uint64_t generation, bool &any_stale) {
+		any_stale = false;
+		bool ok = true;
+		for (page &p : pages) {
+			if (p.verified)
+				continue;
+			size_t n = n_samples(p, p.dirty);
+			uint64_t h = hash_words(p.addr ^ generation * 0x9e3779b97f4a7c15ull, {});
+			bool match = true;
+			for (size_t i = 0; i < n; ++i) {
+				size_t index = (h + i * (p.words.size() / n)) % p.words.size();
+				write_addr_trigger_read(t, p.addr + index, asize);
+				match = read_buf(t) == p.words[index] && match;
+				++stats.words_verified;
+			}
+			if (match) {
+				p.dirty = false;
+				p.verified = true;
+			} else if (p.dirty) {
+				ok = false;
+			} else {
+				p.dirty = true;
+				++stats.pages_stale;
+				any_stale = true;
+			}
+		}
+		// One error check for the whole pass: a failed read also shows up
+		// here, whatever data it returned.
+		return check_errors() && ok;
+	}
+
+	// Remove the entries for any target memory covered by these pages. The
+	// entries never overlap each other, so only the one just below a page can
+	// reach into it from below.
+	static void drop_overlaps(manifest_map &m, const std::vector<page> &pages) {
+		for (const page &p : pages) {
+			uint64_t end = p.addr + p.words.size();
+			auto it = m.lower_bound(std::make_pair(p.addr, (size_t)0));
+			if (it != m.begin()) {
+				auto prev = std::prev(it);
+				if (prev->first.first + prev->first.second > p.addr)
+					it = prev;
+			}
+			while (it != m.end() && it->first.first < end)
+				it = m.erase(it);
+		}
+	}
+
+	// One line per page: word address, word count, hash. The first line is
+	// the load counter.
+	void read_manifest(manifest_map &old, uint64_t &generation) {
+		FILE *f = fopen(manifest_path.c_str(), "r");
+		if (!f)
+			return;
+		unsigned long long gen, addr, n, hash;
+		if (fscanf(f, "twd-manifest %llu\n", &gen) == 1) {
+			generation = gen;
+			while (fscanf(f, "%llx %llx %llx\n", &addr, &n, &hash) == 3)
+				old[std::make_pair((uint64_t)addr, (size_t)n)] = hash;
+		}
+		fclose(f);
+	}
+
+	bool write_manifest(const manifest_map &m, uint64_t generation) {
+		FILE *f = fopen(manifest_path.c_str(), "w");
+		if (!f)
+			return false;
+		fprintf(f, "twd-manifest %llu\n", (unsigned long long)generation);
+		for (const auto &e : m) {
+			fprintf(f, "%llx %llx %016llx\n", (unsigned long long)e.first.first,
+				(unsigned long long)e.first.second, (unsigned long long)e.second);
+		}
+		return fclose(f) == 0;
+	}
+};
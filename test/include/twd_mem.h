@@ -0,0 +1,256 @@
+#pragma once
+
+// Word-granular memory access on top of twd_util.h, tuned for debugger
+// traffic: lots of small, scattered and frequently repeated reads.
+//
+// - All requests in a batch are split into words. Words missing from the
+//   cache are sorted, deduplicated, and coalesced into AINCR bursts
+//   (W.ADDR.R, R.DATA..., R.BUFF).
+// - With read_gaps set, small gaps between requested words are also read
+//   through when that is cheaper than re-addressing. Only set this when every
+//   address that could fall in a gap is safe to read, i.e. not MMIO with
+//   read side effects. Gap words are discarded, never cached.
+// - Recently read words are kept in a small direct-mapped cache. Any write
+//   invalidates the words it touches.
+// - Writes are merged in order (later writes win where they overlap) and
+//   issued as W.ADDR + W.DATA bursts. W.ADDR is skipped if ADDR already
+//   points at the start of the burst.
+// - Errors are checked once per batch, with R.CSR, and cleared on failure.
+//   A failed read batch returns all-zeroes in every requested word.
+//
+// Addresses are word addresses, as in ADDR. The DTM must already be
+// connected when the twd_mem is constructed.
+//
+// The twd_mem assumes it has exclusive use of the DTM: it remembers where
+// ADDR points, and cached words go stale if anything else writes memory. If
+// anything else uses the DTM in between (raw twd_util.h commands, a
+// twd_loader, another twd_mem) or the target runs, call invalidate() before
+// the next access.
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include "tb.h"
+#include "twd_util.h"
+
+struct twd_mem_range {
+	uint64_t addr;
+	size_t n;
+	uint32_t *data;
+};
+
+struct twd_mem_stats {
+	uint64_t words_requested;
+	uint64_t words_hit;
+	uint64_t words_fetched;     // Includes gap words read to join bursts
+	uint64_t words_written;
+	uint64_t read_bursts;
+	uint64_t write_bursts;
+	uint64_t errors;
+	uint64_t dck_cycles;        // Spent inside twd_mem calls
+};
+
+class twd_mem {
+public:
+	// cache_words must be a power of two. Zero disables caching.
+	twd_mem(tb &t_, size_t cache_words = 1024, bool read_gaps_ = false) :
+		t(t_), cache(cache_words), read_gaps(read_gaps_) {
+		stats = {};
+		last_csr = 0;
+		addr_known = false;
+		next_addr = 0;
+		uint32_t csr;
+		tb_assert(read_csr(t, &csr), "twd_mem: bad parity on CSR read\n");
+		asize = (csr & CSR_ASIZE_BITS) >> CSR_ASIZE_LSB;
+		// Only set AINCR: leave the other control fields as the host left them
+		csr_ctrl = (csr & CSR_CTRL_BITS) | CSR_AINCR_BITS;
+		write_csr(t, csr_ctrl);
+		invalidate();
+	}
+
+	bool read(uint64_t addr, uint32_t *data, size_t n) {
+		twd_mem_range r = {addr, n, data};
+		return read_batch(&r, 1);
+	}
+
+	bool write(uint64_t addr, const uint32_t *data, size_t n) {
+		twd_mem_range r = {addr, n, const_cast<uint32_t*>(data)};
+		return write_batch(&r, 1);
+	}
+
+	bool read_batch(const twd_mem_range *ranges, size_t n_ranges) {
+		uint64_t start_cycles = t.get_dck_cycles();
+		// Serve hits immediately, so that filling the cache with this batch's
+		// misses can't evict words we have already counted as hits.
+		std::vector<std::pair<uint64_t, uint32_t*>> misses;
+		for (size_t i = 0; i < n_ranges; ++i) {
+			for (size_t j = 0; j < ranges[i].n; ++j) {
+				uint64_t addr = ranges[i].addr + j;
+				++stats.words_requested;
+				if (cache_lookup(addr, &ranges[i].data[j]))
+					++stats.words_hit;
+				else
+					misses.push_back({addr, &ranges[i].data[j]});
+			}
+		}
+		std::sort(misses.begin(), misses.end());
+
+		std::map<uint64_t, uint32_t> fetched;
+		bool ok = true;
+		size_t i = 0;
+		while (i < misses.size()) {
+			uint64_t first = misses[i].first;
+			uint64_t last = first;
+			while (i < misses.size() && (misses[i].first - last <= 1 ||
+				(read_gaps && (misses[i].first - last) * COST_WORD <= addr_cost() + COST_WORD))) {
+				last = misses[i].first;
+				++i;
+			}
+			ok = read_burst(first, last - first + 1, fetched) && ok;
+		}
+		if (!misses.empty())
+			ok = check_errors() && ok;
+
+		if (ok) {
+			for (auto &m : misses) {
+				*m.second = fetched[m.first];
+				cache_insert(m.first, *m.second);
+			}
+		} else {
+			for (size_t i = 0; i < n_ranges; ++i)
+				std::fill(ranges[i].data, ranges[i].data + ranges[i].n, 0u);
+		}
+		stats.dck_cycles += t.get_dck_cycles() - start_cycles;
+		return ok;
+	}
+
+	bool write_batch(const twd_mem_range *ranges, size_t n_ranges) {
+		uint64_t start_cycles = t.get_dck_cycles();
+		std::map<uint64_t, uint32_t> merged;
+		for (size_t i = 0; i < n_ranges; ++i) {
+			for (size_t j = 0; j < ranges[i].n; ++j) {
+				merged[ranges[i].addr + j] = ranges[i].data[j];
+				cache_invalidate(ranges[i].addr + j);
+			}
+		}
+		auto it = merged.begin();
+		while (it != merged.end()) {
+			uint64_t addr = it->first;
+			if (!addr_known || next_addr != addr)
+				write_addr(t, addr, asize);
+			++stats.write_bursts;
+			while (it != merged.end() && it->first == addr) {
+				write_data(t, it->second);
+				++stats.words_written;
+				++addr;
+				++it;
+			}
+			addr_known = true;
+			next_addr = addr;
+		}
+		bool ok = merged.empty() || check_errors();
+		stats.dck_cycles += t.get_dck_cycles() - start_cycles;
+		return ok;
+	}
+
+	// Forget cached words, and where ADDR points
+	void invalidate() {
+		for (auto &c : cache)
+			c.valid = false;
+		addr_known = false;
+	}
+
+	// CSR value read back by the most recent failed batch
+	uint32_t get_last_error_csr() {
+		return last_csr;
+	}
+
+	twd_mem_stats stats;
+
+private:
+	// Serial cost in DCK cycles of one 32-bit read/write command with parity
+	static const uint64_t COST_WORD = 8 + 32 + 4;
+
+	struct cache_entry {
+		uint64_t addr;
+		uint32_t data;
+		bool valid;
+	};
+
+	tb &t;
+	std::vector<cache_entry> cache;
+	bool read_gaps;
+	unsigned int asize;
+	uint32_t csr_ctrl;
+	uint32_t last_csr;
+	bool addr_known;
+	uint64_t next_addr;
+
+	// Cost of a W.ADDR or W.ADDR.R, i.e. of starting a new burst
+	uint64_t addr_cost() {
+		return 8 + 8 * (asize + 1) + 4;
+	}
+
+	bool cache_lookup(uint64_t addr, uint32_t *data) {
+		if (cache.empty())
+			return false;
+		cache_entry &c = cache[addr & (cache.size() - 1)];
+		if (c.valid && c.addr == addr) {
+			*data = c.data;
+			return true;
+		}
+		return false;
+	}
+
+	void cache_insert(uint64_t addr, uint32_t data) {
+		if (cache.empty())
+			return;
+		cache[addr & (cache.size() - 1)] = {addr, data, true};
+	}
+
+	void cache_invalidate(uint64_t addr) {
+		if (cache.empty())
+			return;
+		cache_entry &c = cache[addr & (cache.size() - 1)];
+		if (c.addr == addr)
+			c.valid = false;
+	}
+
+	bool read_data_cmd(twd_cmd cmd, uint32_t *data) {
+		uint8_t data_bytes[4];
+		send_command_byte(t, cmd);
+		get_bits(t, data_bytes, 32);
+		*data = bytes_to_ule32(data_bytes);
+		return check_parity_byte(t, data_bytes, 32);
+	}
+
+	bool read_burst(uint64_t addr, uint64_t n, std::map<uint64_t, uint32_t> &fetched) {
+		bool ok = true;
+		write_addr_trigger_read(t, addr, asize);
+		for (uint64_t i = 0; i < n; ++i) {
+			uint32_t data;
+			ok = read_data_cmd(i == n - 1 ? CMD_R_BUFF : CMD_R_DATA, &data) && ok;
+			fetched[addr + i] = data;
+		}
+		++stats.read_bursts;
+		stats.words_fetched += n;
+		addr_known = true;
+		next_addr = addr + n;
+		return ok;
+	}
+
+	bool check_errors() {
+		uint32_t csr;
+		if (check_csr_errors(t, &csr_ctrl, &csr))
+			return true;
+		++stats.errors;
+		last_csr = csr;
+		// ADDR stops incrementing at the first failed access, so we no longer
+		// know where it points.
+		addr_known = false;
+		return false;
+	}
+};
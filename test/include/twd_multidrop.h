@@ -0,0 +1,227 @@
+#pragma once
+
+// Multidrop helpers: address assignment, and enumeration of every target on
+// the bus.
+//
+// Enumeration is one precomputed serial stream rather than interactive calls,
+// so a host (e.g. an SPI probe) can clock it out in one transfer and decode
+// the sampled bits afterwards. For each of the 16 addresses the stream holds
+// Connect, R.IDCODE, R.CSR, Disconnect: 248 DCK cycles, so 3968 in all. Nobody
+// answers at an empty address, so the bus pulldown returns all-zeroes, which
+// always has bad parity.
+//
+// On a sparse bus, the sparse option splits this into two streams:
+//
+// 1. For all 16 addresses: Connect, R.STAT, Disconnect. This is a 176-cycle
+//    probe instead of a 248-cycle identification.
+// 2. For responding addresses only: Connect, R.IDCODE, R.CSR, Disconnect.
+//
+// That costs 2816 cycles plus 248 per target, which is cheaper with up to 4
+// targets, at the price of a second transfer.
+//
+// Disconnected targets only react to a Connect with their own address, so
+// commands sent to an empty address are harmless.
+
+#include <vector>
+#include <cstdint>
+
+#include "tb.h"
+#include "twd_util.h"
+
+static const unsigned int N_MDROPADDR = 16;
+
+// ----------------------------------------------------------------------------
+// Precomputed serial streams
+
+// One DCK cycle per symbol. The host either drives DIO, releases it without
+// looking, or releases it and records what it sees (a target's DO, or 0 from
+// the pulldown).
+typedef enum {
+	SYM_DRIVE_0 = 0,
+	SYM_DRIVE_1 = 1,
+	SYM_HIZ     = 2,
+	SYM_SAMPLE  = 3
+} twd_stream_sym;
+
+struct twd_stream {
+	std::vector<uint8_t> syms;
+	size_t n_samples = 0;
+
+	// MSB-first wire order, same as put_bits()
+	void put_bits(const uint8_t *tx, int n_bits) {
+		for (int i = 0; i < n_bits; ++i) {
+			// A short last group takes the LSBs of its byte
+			int group = n_bits - i / 8 * 8 < 8 ? n_bits - i / 8 * 8 : 8;
+			int bit = group - 1 - i % 8;
+			syms.push_back((tx[i / 8] >> bit) & 0x1u ? SYM_DRIVE_1 : SYM_DRIVE_0);
+		}
+	}
+
+	void hiz(int n_bits) {
+		syms.insert(syms.end(), n_bits, SYM_HIZ);
+	}
+
+	// Returns the index of the first sample, for unpack()
+	size_t get_bits(int n_bits) {
+		size_t pos = n_samples;
+		syms.insert(syms.end(), n_bits, SYM_SAMPLE);
+		n_samples += n_bits;
+		return pos;
+	}
+
+	// Same framing as send_command_byte()
+	void command(twd_cmd cmd) {
+		uint8_t start_bit = 1;
+		uint8_t parity = !(((uint8_t)cmd >> 3 ^ (uint8_t)cmd >> 2 ^ (uint8_t)cmd >> 1 ^ (uint8_t)cmd) & 0x1u);
+		uint8_t cmd_bits = cmd;
+		uint8_t turnaround = 0;
+		put_bits(&start_bit, 1);
+		put_bits(&cmd_bits, 4);
+		put_bits(&parity, 1);
+		if (parity)
+			put_bits(&turnaround, 2);
+		else
+			hiz(2);
+	}
+
+	void connect(uint8_t addr) {
+		put_bits(seq_connect_noaddr, 144);
+		addr = (addr << 4) | (~addr & 0xfu);
+		put_bits(&addr, 8);
+	}
+};
+
+// Clock out a stream, with the same DCK/DIO timing as put_bits(), get_bits()
+// and hiz_clocks(). rx receives one entry per SYM_SAMPLE.
+static inline void run_stream(tb &t, const twd_stream &s, std::vector<uint8_t> &rx) {
+	rx.clear();
+	rx.reserve(s.n_samples);
+	for (uint8_t sym : s.syms) {
+		if (sym == SYM_SAMPLE) {
+			t.step();
+			bool sample = t.get_do();
+			t.set_di(sample);
+			rx.push_back(sample);
+		} else {
+			t.set_di(sym == SYM_HIZ ? t.get_do() : sym == SYM_DRIVE_1);
+			t.step();
+		}
+		t.set_dck(1);
+		t.step();
+		t.set_dck(0);
+	}
+}
+
+// Pack sampled bits back into bytes, the same way get_bits() does.
+static inline void unpack_bits(const std::vector<uint8_t> &rx, size_t pos, uint8_t *out, int n_bits) {
+	uint8_t shifter = 0;
+	for (int i = 0; i < n_bits; ++i) {
+		shifter = (shifter << 1) | rx[pos + i];
+		if (i % 8 == 7 || i == n_bits - 1)
+			out[i / 8] = shifter;
+	}
+}
+
+static inline bool unpack_parity_ok(const std::vector<uint8_t> &rx, size_t parity_pos, const uint8_t *data, int n_bits) {
+	uint8_t parity;
+	unpack_bits(rx, parity_pos, &parity, 4);
+	return parity == (odd_parity(data, n_bits) << 3);
+}
+
+// ----------------------------------------------------------------------------
+// Address assignment and enumeration
+
+// Procedure from the spec for targets without address straps: hold every
+// target in reset, then release them one at a time, connecting at address 0
+// and moving each to its new address. addrs[i] is the address for tb
+// instance i, and addresses must be unique. A target assigned address 0 is
+// released last, since it would otherwise answer the Connect meant for the
+// next target.
+static inline void assign_mdropaddrs(tb &t, const uint8_t *addrs, unsigned int n) {
+	uint16_t used = 0;
+	for (unsigned int i = 0; i < n; ++i) {
+		tb_assert(addrs[i] < N_MDROPADDR && !(used & 1u << addrs[i]),
+			"assign_mdropaddrs: bad or duplicate address %u\n", addrs[i]);
+		used |= 1u << addrs[i];
+		t.set_reset(i, true);
+	}
+	idle_clocks(t, 1);
+	for (int pass = 0; pass < 2; ++pass) {
+		for (unsigned int i = 0; i < n; ++i) {
+			if ((addrs[i] == 0) != (pass == 1))
+				continue;
+			t.set_reset(i, false);
+			idle_clocks(t, 1);
+			connect_target(t, 0);
+			write_csr(t, (uint32_t)addrs[i] << CSR_MDROPADDR_LSB);
+			send_command_byte(t, CMD_DISCONNECT);
+		}
+	}
+}
+
+struct twd_target_info {
+	bool present;
+	uint32_t idcode;
+	uint32_t csr;
+};
+
+// Probe all 16 multidrop addresses and fill in the inventory, identifying
+// only R.STAT responders if sparse is set. Leaves every target Disconnected.
+// Returns the number of targets found.
+static inline unsigned int enumerate_targets(tb &t, twd_target_info inventory[N_MDROPADDR], bool sparse = false) {
+	std::vector<unsigned int> candidates;
+	std::vector<uint8_t> rx;
+	for (unsigned int addr = 0; addr < N_MDROPADDR; ++addr)
+		inventory[addr] = {};
+	if (sparse) {
+		twd_stream probe;
+		size_t stat_pos[N_MDROPADDR];
+		for (unsigned int addr = 0; addr < N_MDROPADDR; ++addr) {
+			probe.connect(addr);
+			probe.command(CMD_R_STAT);
+			stat_pos[addr] = probe.get_bits(8);
+			probe.command(CMD_DISCONNECT);
+		}
+		run_stream(t, probe, rx);
+		for (unsigned int addr = 0; addr < N_MDROPADDR; ++addr) {
+			uint8_t stat;
+			unpack_bits(rx, stat_pos[addr], &stat, 4);
+			if (unpack_parity_ok(rx, stat_pos[addr] + 4, &stat, 4))
+				candidates.push_back(addr);
+		}
+		if (candidates.empty())
+			return 0;
+	} else {
+		for (unsigned int addr = 0; addr < N_MDROPADDR; ++addr)
+			candidates.push_back(addr);
+	}
+
+	twd_stream s;
+	size_t idcode_pos[N_MDROPADDR];
+	size_t csr_pos[N_MDROPADDR];
+	for (unsigned int addr : candidates) {
+		s.connect(addr);
+		s.command(CMD_R_IDCODE);
+		idcode_pos[addr] = s.get_bits(36);
+		s.command(CMD_R_CSR);
+		csr_pos[addr] = s.get_bits(36);
+		s.command(CMD_DISCONNECT);
+	}
+	run_stream(t, s, rx);
+
+	unsigned int n_found = 0;
+	for (unsigned int addr : candidates) {
+		twd_target_info &info = inventory[addr];
+		uint8_t idcode_bytes[4];
+		uint8_t csr_bytes[4];
+		unpack_bits(rx, idcode_pos[addr], idcode_bytes, 32);
+		unpack_bits(rx, csr_pos[addr], csr_bytes, 32);
+		info.idcode = bytes_to_ule32(idcode_bytes);
+		info.csr = bytes_to_ule32(csr_bytes);
+		info.present =
+			unpack_parity_ok(rx, idcode_pos[addr] + 32, idcode_bytes, 32) &&
+			unpack_parity_ok(rx, csr_pos[addr] + 32, csr_bytes, 32);
+		n_found += info.present;
+	}
+	return n_found;
+}
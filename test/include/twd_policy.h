@@ -0,0 +1,320 @@
+#pragma once
+
+// Adaptive error checking for downstream writes.
+//
+// A host can find out whether its writes landed in two ways:
+//
+// - R.STAT polling: R.STAT after every W.DATA, repeated until BUSY clears.
+//   A word is never sent while the bus is busy, so EBUSY never happens, and
+//   a bus fault costs only a CSR clear and one resend. Every word pays for
+//   at least one R.STAT, plus one more for each 16 cycles of bus latency.
+// - Deferred checks: a batch of back-to-back W.DATAs, then one R.CSR. This is
+//   cheap when nothing goes wrong. But the first EBUSY or EBUSFAULT blocks
+//   everything up to the end of the batch. Recovery is a CSR clear and an
+//   R.ADDR to find the first word that didn't land, then a resend of the
+//   rest of the batch.
+//
+// twd_policy keeps running estimates, per target, of:
+// - the per-word EBUSY and EBUSFAULT rates;
+// - how many R.STATs a word needs.
+// Before each batch it computes the expected DCK cycles per successfully
+// written word, for R.STAT polling and for deferred checks at each batch
+// length. It then picks the cheapest. The batch length can shrink straight
+// to the optimum, but only grows by doubling, so one lucky batch can't
+// commit a large one. There is some hysteresis on switching modes.
+//
+// ADDR only increments on a successful access, so after an error it always
+// points at the first word to resend.
+//
+// Use one twd_policy per target: the estimates describe that target's
+// downstream bus. The DTM must already be connected when the twd_policy is
+// constructed.
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+
+#include "tb.h"
+#include "twd_util.h"
+
+typedef enum {
+	POLL_STAT,      // R.STAT after every word
+	POLL_DEFERRED   // R.CSR after every batch
+} twd_poll_mode;
+
+struct twd_policy_stats {
+	uint64_t words_written;     // Successfully, i.e. not counting resends
+	uint64_t words_sent;        // Including resends, and words ignored after an error
+	uint64_t stat_polls;
+	uint64_t batches;
+	uint64_t busy_errors;
+	uint64_t fault_errors;
+	uint64_t mode_switches;
+	uint64_t dck_cycles;        // Spent inside twd_policy calls
+};
+
+class twd_policy {
+public:
+	// A word which faults more than max_retries times in a row fails the
+	// write. max_batch must be a power of two.
+	twd_policy(tb &t_, unsigned int max_batch_ = 64, unsigned int max_retries_ = 3) :
+		t(t_), max_batch(max_batch_), max_retries(max_retries_) {
+		stats = {};
+		mode = POLL_DEFERRED;
+		batch_len = 4;
+		pinned = false;
+		p_busy = 0.0;
+		p_fault = 0.0;
+		polls_per_word = 1.0;
+		uint32_t csr;
+		tb_assert(read_csr(t, &csr), "twd_policy: bad parity on CSR read\n");
+		asize = (csr & CSR_ASIZE_BITS) >> CSR_ASIZE_LSB;
+		// Only set AINCR: leave the other control fields as the host left them
+		csr_ctrl = (csr & CSR_CTRL_BITS) | CSR_AINCR_BITS;
+		write_csr(t, csr_ctrl);
+	}
+
+	// Write n words to consecutive addresses. Returns false if a word kept
+	// faulting, or the link stopped responding sensibly.
+	bool write(uint64_t addr, const uint32_t *data, size_t n) {
+		uint64_t start_cycles = t.get_dck_cycles();
+		bool ok = true;
+		size_t done = 0;
+		fault_index = SIZE_MAX;
+		fault_count = 0;
+		if (n)
+			write_addr(t, addr, asize);
+		while (ok && done < n) {
+			choose();
+			if (mode == POLL_STAT)
+				ok = write_polled(data, done, n);
+			else
+				ok = write_deferred(addr, data, done, n);
+		}
+		stats.dck_cycles += t.get_dck_cycles() - start_cycles;
+		return ok;
+	}
+
+	// Stop adapting, and always use this mode and batch length. For
+	// comparison with fixed strategies.
+	void pin(twd_poll_mode mode_, unsigned int batch_len_) {
+		mode = mode_;
+		batch_len = batch_len_;
+		pinned = true;
+	}
+
+	twd_poll_mode get_mode() {
+		return mode;
+	}
+
+	unsigned int get_batch_len() {
+		return batch_len;
+	}
+
+	double get_busy_rate() {
+		return p_busy;
+	}
+
+	double get_fault_rate() {
+		return p_fault;
+	}
+
+	twd_policy_stats stats;
+
+private:
+	// Serial costs in DCK cycles
+	static constexpr double COST_WORD = 8 + 32 + 4;   // W.DATA, R.CSR, W.CSR
+	static constexpr double COST_STAT = 8 + 8;        // R.STAT
+	// Each estimate update counts as one observation per word, with this
+	// weight, so about the last 1 / EWMA_WEIGHT words matter.
+	static constexpr double EWMA_WEIGHT = 1.0 / 32;
+	// Don't switch mode for less than this fractional improvement
+	static constexpr double HYSTERESIS = 0.05;
+	static const unsigned int MAX_POLLS = 1000;
+	// Words between decisions while polling
+	static const unsigned int POLL_CHUNK = 16;
+
+	tb &t;
+	unsigned int max_batch;
+	unsigned int max_retries;
+	unsigned int asize;
+	uint32_t csr_ctrl;
+
+	twd_poll_mode mode;
+	unsigned int batch_len;
+	bool pinned;
+	double p_busy;
+	double p_fault;
+	double polls_per_word;
+
+	// Consecutive faults on the same word, for max_retries
+	size_t fault_index;
+	unsigned int fault_count;
+
+	// Fold in n observations whose mean is x
+	static void ewma(double &est, double x, size_t n) {
+		double keep = std::pow(1.0 - EWMA_WEIGHT, (double)n);
+		est = est * keep + x * (1.0 - keep);
+	}
+
+	double cost_recover() {
+		// W.CSR to clear, R.ADDR to find where we stopped
+		return COST_WORD + 8 + 8 * (asize + 1) + 4;
+	}
+
+	double cost_polled() {
+		return COST_WORD + COST_STAT * polls_per_word + p_fault * (COST_WORD + COST_WORD);
+	}
+
+	// Expected cycles per successful word for a batch of b words, if each
+	// word independently fails with probability p and blocks the rest.
+	double cost_deferred(unsigned int b) {
+		double p = std::min(p_busy + p_fault, 0.99);
+		double q = 1.0 - p;
+		double p_clean = std::pow(q, (double)b);
+		double expect_done = p < 1e-9 ? b : q * (1.0 - p_clean) / p;
+		double cost = b * COST_WORD + COST_WORD + (1.0 - p_clean) * cost_recover();
+		return cost / std::max(expect_done, 1e-9);
+	}
+
+	void choose() {
+		if (pinned)
+			return;
+		unsigned int best_b = 1;
+		double best_cost = cost_deferred(1);
+		for (unsigned int b = 2; b <= max_batch; b *= 2) {
+			double c = cost_deferred(b);
+			if (c < best_cost) {
+				best_cost = c;
+				best_b = b;
+			}
+		}
+		batch_len = std::min(best_b, batch_len * 2);
+
+		double polled = cost_polled();
+		twd_poll_mode next = mode;
+		if (mode == POLL_DEFERRED && polled < best_cost * (1.0 - HYSTERESIS))
+			next = POLL_STAT;
+		else if (mode == POLL_STAT && best_cost < polled * (1.0 - HYSTERESIS))
+			next = POLL_DEFERRED;
+		if (next != mode) {
+			++stats.mode_switches;
+			mode = next;
+		}
+	}
+
+	// Poll R.STAT until BUSY clears. Returns the number of polls, or 0 if
+	// the flags couldn't be read.
+	unsigned int wait_not_busy(uint8_t *stat) {
+		for (unsigned int polls = 1; polls <= MAX_POLLS; ++polls) {
+			++stats.stat_polls;
+			if (!read_stat(t, stat))
+				return 0;
+			if (!(*stat & STAT_BUSY_BITS))
+				return polls;
+		}
+		return 0;
+	}
+
+	// Returns false if this word has now faulted too many times
+	bool note_fault(size_t index) {
+		++stats.fault_errors;
+		if (index != fault_index) {
+			fault_index = index;
+			fault_count = 0;
+		}
+		return ++fault_count <= max_retries;
+	}
+
+	// POLL_CHUNK words, polling after each
+	bool write_polled(const uint32_t *data, size_t &done, size_t n) {
+		size_t end = std::min<size_t>(done + POLL_CHUNK, n);
+		size_t sent = 0, faults = 0, would_be_busy = 0, polls_total = 0;
+		while (done < end) {
+			uint8_t stat;
+			write_data(t, data[done]);
+			++sent;
+			++stats.words_sent;
+			unsigned int polls = wait_not_busy(&stat);
+			if (!polls)
+				return false;
+			polls_total += polls;
+			// Would a back-to-back W.DATA, COST_WORD cycles after this one,
+			// have found the bus busy? The last R.STAT which saw BUSY started
+			// (polls - 2) * COST_STAT cycles after this W.DATA, and sampled
+			// the flag about halfway through.
+			if ((polls - 2.0) * COST_STAT + COST_STAT / 2 >= COST_WORD)
+				++would_be_busy;
+			if (stat & (STAT_EPARITY_BITS | STAT_EBUSFAULT_BITS | STAT_EBUSY_BITS)) {
+				clear_csr_errors(t, csr_ctrl);
+				if (stat & STAT_EBUSFAULT_BITS) {
+					++faults;
+					if (!note_fault(done))
+						return false;
+				}
+				if (stat & STAT_EBUSY_BITS)
+					++stats.busy_errors;
+				if (stat & STAT_EPARITY_BITS)
+					return false;
+				// ADDR didn't move, so just send the same word again
+				continue;
+			}
+			++done;
+			++stats.words_written;
+		}
+		ewma(p_fault, (double)faults / sent, sent);
+		ewma(p_busy, (double)would_be_busy / sent, sent);
+		ewma(polls_per_word, (double)polls_total / sent, sent);
+		return true;
+	}
+
+	bool write_deferred(uint64_t addr, const uint32_t *data, size_t &done, size_t n) {
+		size_t b = std::min<size_t>(batch_len, n - done);
+		for (size_t i = 0; i < b; ++i)
+			write_data(t, data[done + i]);
+		stats.words_sent += b;
+		++stats.batches;
+
+		uint32_t csr;
+		if (!read_csr(t, &csr))
+			return false;
+		if (csr & CSR_BUSY_BITS) {
+			// The last write is still going. Wait for it before the next
+			// batch, or its first word gets EBUSY.
+			uint8_t stat;
+			if (!wait_not_busy(&stat))
+				return false;
+			if (stat & STAT_EBUSFAULT_BITS)
+				csr |= CSR_EBUSFAULT_BITS;
+		}
+		if (!(csr & CSR_ERR_BITS)) {
+			done += b;
+			stats.words_written += b;
+			ewma(p_busy, 0.0, b);
+			ewma(p_fault, 0.0, b);
+			return true;
+		}
+
+		if (csr & CSR_EPARITY_BITS)
+			return false;
+		clear_csr_errors(t, csr_ctrl);
+		uint64_t stopped_at = read_addr(t, asize);
+		if (stopped_at < addr + done || stopped_at > addr + done + b)
+			return false;
+		size_t landed = stopped_at - addr - done;
+		// Everything up to and including the failed word was a fair trial
+		size_t tried = std::min(landed + 1, b);
+		bool busy = csr & CSR_EBUSY_BITS;
+		bool fault = csr & CSR_EBUSFAULT_BITS;
+		ewma(p_busy, busy ? 1.0 / tried : 0.0, tried);
+		ewma(p_fault, fault ? 1.0 / tried : 0.0, tried);
+		if (busy)
+			++stats.busy_errors;
+		done += landed;
+		stats.words_written += landed;
+		if (fault && !note_fault(done))
+			return false;
+		return true;
+	}
+};
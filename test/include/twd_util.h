@@ -32,6 +32,17 @@ static const uint8_t seq_connect_noaddr[] = {
 	// Then 4-bit address, followed by its complement
 };
 
+// Shorter sequence to reconnect after a parity error, if CSR.RESUMEEN was set
+static const uint8_t seq_resume_noaddr[] = {
+	// Sync LFSR
+	0x00,
+	// First 16 bits of LFSR output
+	0xa7, 0xa3,
+	// 72 1s
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+	// Then 4-bit address, followed by its complement
+};
+
 static const unsigned CSR_ASIZE_LSB         = 24;
 static const uint32_t CSR_ASIZE_BITS        = 0x07000000u;
 static const unsigned CSR_EPARITY_LSB       = 18;
@@ -40,6 +51,8 @@ static const unsigned CSR_EBUSFAULT_LSB     = 17;
 static const uint32_t CSR_EBUSFAULT_BITS    = 0x00020000u;
 static const unsigned CSR_EBUSY_LSB         = 16;
 static const uint32_t CSR_EBUSY_BITS        = 0x00010000u;
+static const unsigned CSR_RESUMEEN_LSB      = 13;
+static const uint32_t CSR_RESUMEEN_BITS     = 0x00002000u;
 static const unsigned CSR_AINCR_LSB         = 12;
 static const uint32_t CSR_AINCR_BITS        = 0x00001000u;
 static const unsigned CSR_BUSY_LSB          = 8;
@@ -51,6 +64,18 @@ static const uint32_t CSR_NDTMRESET_BITS    = 0x00000010u;
 static const unsigned CSR_MDROPADDR_LSB     = 0;
 static const uint32_t CSR_MDROPADDR_BITS    = 0x0000000fu;
 
+// Writable CSR fields which aren't write-1-to-clear. Write these back as
+// read, so e.g. a system reset held through NDTMRESET isn't released.
+static const uint32_t CSR_CTRL_BITS = CSR_RESUMEEN_BITS | CSR_AINCR_BITS | CSR_NDTMRESET_BITS | CSR_MDROPADDR_BITS;
+// Sticky error flags, write-1-to-clear
+static const uint32_t CSR_ERR_BITS  = CSR_EPARITY_BITS | CSR_EBUSFAULT_BITS | CSR_EBUSY_BITS;
+
+// R.STAT response flags, MSB first on the wire
+static const uint8_t STAT_EPARITY_BITS      = 0x8u;
+static const uint8_t STAT_EBUSFAULT_BITS    = 0x4u;
+static const uint8_t STAT_EBUSY_BITS        = 0x2u;
+static const uint8_t STAT_BUSY_BITS         = 0x1u;
+
 static inline uint32_t bytes_to_ule32(const uint8_t b[4]) {
 	return (uint32_t)b[3] << 24 | b[2] << 16 | b[1] << 8 | b[0];
 }
@@ -88,7 +113,7 @@ static inline void put_bits(tb &t, const uint8_t *tx, int n_bits) {
 }
 
 static inline void get_bits(tb &t, uint8_t *rx, int n_bits) {
-	uint8_t shifter;
+	uint8_t shifter = 0;
 	for (int i = 0; i < n_bits; ++i) {
 		t.step();
 		bool sample = t.get_do();
@@ -132,6 +157,12 @@ static inline void connect_target(tb &t, uint8_t addr) {
 	put_bits(t, &addr, 8);
 }
 
+static inline void resume_target(tb &t, uint8_t addr) {
+	put_bits(t, seq_resume_noaddr, 96);
+	addr = (addr << 4) | (~addr & 0xfu);
+	put_bits(t, &addr, 8);
+}
+
 static inline void send_command_byte(tb &t, twd_cmd cmd) {
 	uint8_t start_bit = 1;
 	uint8_t parity = !(((uint8_t)cmd >> 3 ^ (uint8_t)cmd >> 2 ^ (uint8_t)cmd >> 1 ^ (uint8_t)cmd) & 0x1u);
@@ -183,6 +214,16 @@ bool read_csr(tb &t, uint32_t *csr) {
 	return check_parity_byte(t, csrbytes, 32);
 }
 
+// returns true == good parity. Only the 4-bit part of the parity byte is
+// sent, so this can't use check_parity_byte().
+bool read_stat(tb &t, uint8_t *stat) {
+	uint8_t parity;
+	send_command_byte(t, CMD_R_STAT);
+	get_bits(t, stat, 4);
+	get_bits(t, &parity, 4);
+	return parity == (odd_parity(stat, 4) << 3);
+}
+
 void write_csr(tb &t, uint32_t csr) {
 	uint8_t csrbytes[4];
 	ule32_to_bytes(csr, csrbytes);
@@ -190,6 +231,25 @@ void write_csr(tb &t, uint32_t csr) {
 	put_bits_with_parity(t, csrbytes, 32);
 }
 
+// Clear the CSR error flags, writing back the control fields in ctrl
+void clear_csr_errors(tb &t, uint32_t ctrl) {
+	write_csr(t, (ctrl & CSR_CTRL_BITS) | CSR_ERR_BITS);
+}
+
+// returns true == good parity and no error flags. Otherwise the errors are
+// cleared. *ctrl holds the control fields to write back: after a good-parity
+// read it is refreshed from the CSR, so changes made since are kept, except
+// for AINCR, which stays as the caller set it.
+bool check_csr_errors(tb &t, uint32_t *ctrl, uint32_t *csr) {
+	bool parity_ok = read_csr(t, csr);
+	if (parity_ok && !(*csr & CSR_ERR_BITS))
+		return true;
+	if (parity_ok)
+		*ctrl = (*csr & CSR_CTRL_BITS & ~CSR_AINCR_BITS) | (*ctrl & CSR_AINCR_BITS);
+	clear_csr_errors(t, *ctrl);
+	return false;
+}
+
 void write_addr(tb &t, uint64_t addr, unsigned int asize) {
 	uint8_t addr_bytes[8];
 	ule32_to_bytes(addr, &addr_bytes[0]);
@@ -0,0 +1,131 @@
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "tb.h"
+#include "twr.h"
+#include "bench.h"
+
+// Replay a run log (see ../tb/twr.h) through the testbench. The logged DCK,
+// DI and reset inputs are applied at the same steps as in the original run,
+// and bus accesses are answered with the logged responses, so no host logic
+// runs at all. The replay fails at the first step where the design does
+// something different: DO differs where the host sampled it, or the design
+// makes a different bus access, or makes it at a different step.
+//
+// Usage: replay log.twr [waves.vcd]
+//
+// The report line has the same format as the benchmarks.
+
+static const char *log_name;
+static std::vector<twr_event> bus_events;
+static size_t bus_next;
+static uint64_t step;
+static uint32_t checksum = BENCH_HASH_INIT;
+
+static const twr_event &next_bus_event(twr_event_type type, uint64_t addr) {
+	const char *kind = type == TWR_BUS_READ ? "read" : "write";
+	tb_assert(bus_next < bus_events.size(), "%s: step %llu: unexpected bus %s at %llx\n",
+		log_name, (unsigned long long)step, kind, (unsigned long long)addr);
+	const twr_event &e = bus_events[bus_next++];
+	tb_assert(e.step == step && e.type == type && e.args[0] == addr,
+		"%s: step %llu: bus %s at %llx, expected %s at %llx in step %llu\n",
+		log_name, (unsigned long long)step, kind, (unsigned long long)addr,
+		e.type == TWR_BUS_READ ? "read" : "write", (unsigned long long)e.args[0], (unsigned long long)e.step);
+	checksum = bench_hash(checksum, addr);
+	return e;
+}
+
+bus_read_response read_callback(uint64_t addr) {
+	const twr_event &e = next_bus_event(TWR_BUS_READ, addr);
+	return {
+		.data = (uint32_t)e.args[1],
+		.delay_cycles = (int)e.args[2],
+		.err = e.args[3] != 0
+	};
+}
+
+bus_write_response write_callback(uint64_t addr, uint32_t data) {
+	const twr_event &e = next_bus_event(TWR_BUS_WRITE, addr);
+	tb_assert(e.args[1] == data, "%s: step %llu: bus write data %08x, expected %08x\n",
+		log_name, (unsigned long long)step, data, (unsigned)e.args[1]);
+	checksum = bench_hash(checksum, data);
+	return {
+		.delay_cycles = (int)e.args[2],
+		.err = e.args[3] != 0
+	};
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "Usage: %s log.twr [waves.vcd]\n", argv[0]);
+		return -1;
+	}
+	log_name = argv[1];
+	// Don't log the replay itself
+	unsetenv("TWD_RECORD");
+
+	unsigned int n_instances;
+	std::vector<twr_event> events;
+	tb_assert(twr_read(log_name, n_instances, events), "%s: not a complete TWR log\n", log_name);
+	std::vector<twr_event> host_events;
+	for (const twr_event &e : events) {
+		if (e.type == TWR_BUS_READ || e.type == TWR_BUS_WRITE)
+			bus_events.push_back(e);
+		else
+			host_events.push_back(e);
+	}
+
+	uint64_t cycles;
+	bench_timer timer;
+	{
+		tb t(argc == 3 ? argv[2] : "", n_instances);
+		for (const twr_event &e : host_events) {
+			while (step < e.step) {
+				t.step();
+				++step;
+			}
+			switch (e.type) {
+			case TWR_DCK_LOW:
+			case TWR_DCK_HIGH:
+				t.set_dck(e.type == TWR_DCK_HIGH);
+				break;
+			case TWR_DI_LOW:
+			case TWR_DI_HIGH:
+				t.set_di(e.type == TWR_DI_HIGH);
+				break;
+			case TWR_DO_LOW:
+			case TWR_DO_HIGH: {
+				bool expect = e.type == TWR_DO_HIGH;
+				bool dout = t.get_do();
+				tb_assert(dout == expect, "%s: step %llu: DO is %d, expected %d\n",
+					log_name, (unsigned long long)step, dout, expect);
+				checksum = bench_hash(checksum, dout);
+				break;
+			}
+			case TWR_RESET:
+				t.set_reset(e.args[0] >> 1, e.args[0] & 0x1u);
+				break;
+			case TWR_CALLBACKS:
+				t.set_bus_read_callback(e.args[0] & 0x1u ? read_callback : NULL);
+				t.set_bus_write_callback(e.args[0] & 0x2u ? write_callback : NULL);
+				break;
+			case TWR_END:
+				tb_assert(bus_next == bus_events.size(), "%s: %llu logged bus accesses never happened\n",
+					log_name, (unsigned long long)(bus_events.size() - bus_next));
+				tb_assert(t.get_dck_cycles() == e.args[0], "%s: %llu DCK cycles, expected %llu\n",
+					log_name, (unsigned long long)t.get_dck_cycles(), (unsigned long long)e.args[0]);
+				break;
+			default:
+				break;
+			}
+		}
+		cycles = t.get_dck_cycles();
+	}
+
+	std::string name(log_name);
+	name = name.substr(name.rfind('/') + 1);
+	name = name.substr(0, name.rfind('.'));
+	bench_report(name.c_str(), cycles, timer.elapsed(), checksum);
+	return 0;
+}
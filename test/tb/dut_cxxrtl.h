@@ -0,0 +1,106 @@
+#pragma once
+
+// CXXRTL simulation backend. Only tb.cpp should include this, since it pulls
+// in the non-inlined implementation of the design.
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <cstdint>
+#include <cxxrtl/cxxrtl.h>
+#include <cxxrtl/cxxrtl_vcd.h>
+
+#include "dut.cpp"
+#include "twv_writer.h"
+
+struct tb_dut {
+	std::vector<std::unique_ptr<cxxrtl_design::p_twowire__dtm>> dtm;
+	bool waves_en;
+#if defined(TB_WAVES_BIN)
+	twv_writer vcd;
+	static constexpr const char *waves_ext = ".twv";
+#else
+	std::ofstream waves_fd;
+	cxxrtl::vcd_writer vcd;
+	static constexpr const char *waves_ext = ".vcd";
+#endif
+
+	tb_dut(std::string vcdfile, unsigned int n_instances) {
+		for (unsigned int i = 0; i < n_instances; ++i)
+			dtm.emplace_back(new cxxrtl_design::p_twowire__dtm);
+		waves_en = !vcdfile.empty();
+		if (waves_en) {
+#if defined(TB_WAVES_BIN)
+			vcd.open(vcdfile);
+#else
+			waves_fd.open(vcdfile);
+#endif
+			cxxrtl::debug_items all_debug_items;
+			// Keep the single-instance hierarchy flat, so existing save files
+			// still work.
+			for (unsigned int i = 0; i < n_instances; ++i) {
+				std::string scope = n_instances == 1 ? "" : "dtm" + std::to_string(i) + " ";
+				dtm[i]->debug_info(&all_debug_items, /*scopes=*/nullptr, scope);
+			}
+			vcd.timescale(1, "us");
+			vcd.add(all_debug_items);
+		}
+	}
+
+	unsigned int size() {
+		return dtm.size();
+	}
+
+	void eval() {
+		for (auto &d : dtm) {
+			d->step();
+			d->step();
+		}
+	}
+
+	void dump(uint64_t timestamp) {
+		if (!waves_en)
+			return;
+		vcd.sample(timestamp);
+#if !defined(TB_WAVES_BIN)
+		waves_fd << vcd.buffer;
+		waves_fd.flush();
+		vcd.buffer.clear();
+#endif
+	}
+
+	void close_waves() {
+#if defined(TB_WAVES_BIN)
+		vcd.close();
+#else
+		waves_fd.close();
+#endif
+		waves_en = false;
+	}
+
+	// DCK and DI are common to all instances
+	void set_dck(bool dck) {
+		for (auto &d : dtm)
+			d->p_dck.set<bool>(dck);
+	}
+	void set_di(bool di) {
+		for (auto &d : dtm)
+			d->p_di.set<bool>(di);
+	}
+	bool get_dck()                                   {return dtm[0]->p_dck.get<bool>();}
+
+	void set_drst_n(unsigned int i, bool drst_n)     {dtm[i]->p_drst__n.set<bool>(drst_n);}
+	bool get_dout(unsigned int i)                    {return dtm[i]->p_dout.get<bool>();}
+	bool get_doe(unsigned int i)                     {return dtm[i]->p_doe.get<bool>();}
+	bool get_host_connected(unsigned int i)          {return dtm[i]->p_host__connected.get<bool>();}
+
+	uint64_t get_paddr(unsigned int i)               {return dtm[i]->p_dst__paddr.get<uint64_t>();}
+	bool get_psel(unsigned int i)                    {return dtm[i]->p_dst__psel.get<bool>();}
+	bool get_penable(unsigned int i)                 {return dtm[i]->p_dst__penable.get<bool>();}
+	bool get_pwrite(unsigned int i)                  {return dtm[i]->p_dst__pwrite.get<bool>();}
+	uint32_t get_pwdata(unsigned int i)              {return dtm[i]->p_dst__pwdata.get<uint32_t>();}
+	void set_pready(unsigned int i, bool pready)     {dtm[i]->p_dst__pready.set<bool>(pready);}
+	void set_pslverr(unsigned int i, bool pslverr)   {dtm[i]->p_dst__pslverr.set<bool>(pslverr);}
+	void set_prdata(unsigned int i, uint32_t prdata) {dtm[i]->p_dst__prdata.set<uint32_t>(prdata);}
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+// Verilator simulation backend. Only tb.cpp should include this. The model
+// is built with --trace, and optionally --threads, by test/tb/Makefile. With
+// WAVES=bin it is built with --trace-fst instead, and Verilator's FST writer
+// runs on its own thread (--trace-threads).
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "verilated.h"
+#if defined(TB_WAVES_BIN)
+#include "verilated_fst_c.h"
+typedef VerilatedFstC tb_waves_file;
+#else
+#include "verilated_vcd_c.h"
+typedef VerilatedVcdC tb_waves_file;
+#endif
+#include "Vtwowire_dtm.h"
+
+struct tb_dut {
+	VerilatedContext ctx;
+	std::vector<std::unique_ptr<Vtwowire_dtm>> dtm;
+	tb_waves_file *waves;
+#if defined(TB_WAVES_BIN)
+	static constexpr const char *waves_ext = ".fst";
+#else
+	static constexpr const char *waves_ext = ".vcd";
+#endif
+
+	tb_dut(std::string vcdfile, unsigned int n_instances) : waves(nullptr) {
+		for (unsigned int i = 0; i < n_instances; ++i) {
+			std::string name = n_instances == 1 ? "twowire_dtm" : "dtm" + std::to_string(i);
+			dtm.emplace_back(new Vtwowire_dtm(&ctx, name.c_str()));
+		}
+		if (!vcdfile.empty()) {
+			ctx.traceEverOn(true);
+			waves = new tb_waves_file;
+			for (auto &d : dtm)
+				d->trace(waves, 99);
+			waves->open(vcdfile.c_str());
+		}
+	}
+
+	~tb_dut() {
+		close_waves();
+		for (auto &d : dtm)
+			d->final();
+	}
+
+	unsigned int size() {
+		return dtm.size();
+	}
+
+	void eval() {
+		for (auto &d : dtm)
+			d->eval();
+	}
+
+	void dump(uint64_t timestamp) {
+		if (!waves)
+			return;
+		waves->dump(timestamp);
+#if !defined(TB_WAVES_BIN)
+		// Match the CXXRTL backend: waves should be complete even if a
+		// testcase bails out through exit().
+		waves->flush();
+#endif
+	}
+
+	void close_waves() {
+		if (waves) {
+			waves->close();
+			delete waves;
+			waves = nullptr;
+		}
+	}
+
+	// DCK and DI are common to all instances
+	void set_dck(bool dck) {
+		for (auto &d : dtm)
+			d->dck = dck;
+	}
+	void set_di(bool di) {
+		for (auto &d : dtm)
+			d->di = di;
+	}
+	bool get_dck()                                   {return dtm[0]->dck;}
+
+	void set_drst_n(unsigned int i, bool drst_n)     {dtm[i]->drst_n = drst_n;}
+	bool get_dout(unsigned int i)                    {return dtm[i]->dout;}
+	bool get_doe(unsigned int i)                     {return dtm[i]->doe;}
+	bool get_host_connected(unsigned int i)          {return dtm[i]->host_connected;}
+
+	uint64_t get_paddr(unsigned int i)               {return dtm[i]->dst_paddr;}
+	bool get_psel(unsigned int i)                    {return dtm[i]->dst_psel;}
+	bool get_penable(unsigned int i)                 {return dtm[i]->dst_penable;}
+	bool get_pwrite(unsigned int i)                  {return dtm[i]->dst_pwrite;}
+	uint32_t get_pwdata(unsigned int i)              {return dtm[i]->dst_pwdata;}
+	void set_pready(unsigned int i, bool pready)     {dtm[i]->dst_pready = pready;}
+	void set_pslverr(unsigned int i, bool pslverr)   {dtm[i]->dst_pslverr = pslverr;}
+	void set_prdata(unsigned int i, uint32_t prdata) {dtm[i]->dst_prdata = prdata;}
+};
@@ -1,127 +1,213 @@
 #include "tb.h"
 
-#include <fstream>
+#include <algorithm>
 #include <cstdint>
 
-#include "dut.cpp"
-#include <cxxrtl/cxxrtl_vcd.h>
-
-tb::tb(std::string vcdfile) {
-	// Raw pointer... CXXRTL doesn't give us the type declaration wihout also
-	// giving us non-inlined implementation, and I'm not very good at C++, so
-	// we do this shit
-	cxxrtl_design::p_twowire__dtm *dtm = new cxxrtl_design::p_twowire__dtm;
-	dut = dtm;
- 
-	waves_fd.open(vcdfile);
-	cxxrtl::debug_items all_debug_items;
-	dtm->debug_info(&all_debug_items, /*scopes=*/nullptr, "");
-	vcd.timescale(1, "us");
-	vcd.add(all_debug_items);
+#include "twr.h"
+
+// Backend is selected at build time, see Makefile. Each backend provides a
+// tb_dut with identical port accessors, so the rest of this file (and every
+// testcase) is simulator-agnostic.
+#if defined(TB_VERILATOR)
+#include "dut_verilator.h"
+#else
+#include "dut_cxxrtl.h"
+#endif
+
+// Testcases always ask for a .vcd file. Give it the extension of whatever
+// format the backend writes instead (see WAVES in tb.mk).
+static std::string waves_filename(std::string vcdfile) {
+	const std::string vcd_ext = ".vcd";
+	if (vcdfile.empty())
+		return vcdfile;
+	if (vcdfile.size() >= vcd_ext.size() && vcdfile.compare(vcdfile.size() - vcd_ext.size(), vcd_ext.size(), vcd_ext) == 0)
+		vcdfile.erase(vcdfile.size() - vcd_ext.size());
+	return vcdfile + tb_dut::waves_ext;
+}
+
+// Log file for the n-th tb in this process, or empty if not recording
+static std::string record_filename(unsigned int n) {
+	const char *name = getenv("TWD_RECORD");
+	if (!name || !*name)
+		return "";
+	std::string s(name);
+	if (n == 0)
+		return s;
+	size_t dot = s.rfind('.');
+	size_t slash = s.rfind('/');
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		dot = s.size();
+	return s.insert(dot, "." + std::to_string(n));
+}
+
+// Waveform and log writers buffer, and waveforms may be written from another
+// thread. Testcases usually fail by calling exit() with the tb still on the
+// stack, so finish off the outputs of every live tb at exit, to keep the
+// interesting part.
+static std::vector<tb_dut*> live_duts;
+static std::vector<twr_writer*> live_recorders;
+static bool close_all_outputs_registered = false;
+static unsigned int tb_count = 0;
+
+static void close_all_outputs() {
+	for (tb_dut *d : live_duts)
+		d->close_waves();
+	for (twr_writer *r : live_recorders)
+		r->close();
+}
+
+tb::tb(std::string vcdfile, unsigned int n_instances) {
+	dut = new tb_dut(waves_filename(vcdfile), n_instances);
+	if (!close_all_outputs_registered) {
+		atexit(close_all_outputs);
+		close_all_outputs_registered = true;
+	}
+	live_duts.push_back(dut);
+	recorder = NULL;
+	std::string record_file = record_filename(tb_count++);
+	if (!record_file.empty()) {
+		recorder = new twr_writer;
+		tb_assert(recorder->open(record_file, n_instances), "Failed to open %s\n", record_file.c_str());
+		live_recorders.push_back(recorder);
+	}
 	vcd_sample = 0;
+	dck_cycles = 0;
 
-	dtm->p_drst__n.set<bool>(false);
-	dtm->step();
-	dtm->p_drst__n.set<bool>(true);
-	dtm->step();
+	for (unsigned int i = 0; i < n_instances; ++i)
+		dut->set_drst_n(i, false);
+	dut->eval();
+	for (unsigned int i = 0; i < n_instances; ++i)
+		dut->set_drst_n(i, true);
+	dut->eval();
 
 	dck_prev = false;
 	read_callback = NULL;
 	write_callback = NULL;
-	last_read_response.delay_cycles = 0;
-	last_write_response.delay_cycles = 0;
+	bus.resize(n_instances);
+	for (bus_state &b : bus) {
+		b.last_read_response.delay_cycles = 0;
+		b.last_write_response.delay_cycles = 0;
+	}
 
-	vcd.sample(vcd_sample++);
-	waves_fd << vcd.buffer;
-	vcd.buffer.clear();
+	dut->dump(vcd_sample++);
+}
+
+tb::~tb() {
+	live_duts.erase(std::find(live_duts.begin(), live_duts.end(), dut));
+	delete dut;
+	if (recorder) {
+		live_recorders.erase(std::find(live_recorders.begin(), live_recorders.end(), recorder));
+		delete recorder;
+	}
 }
 
 void tb::set_bus_read_callback(bus_read_callback cb) {
 	read_callback = cb;
+	if (recorder)
+		recorder->set_callbacks(read_callback, write_callback);
 }
 
 void tb::set_bus_write_callback(bus_write_callback cb) {
 	write_callback = cb;
+	if (recorder)
+		recorder->set_callbacks(read_callback, write_callback);
 }
 
 void tb::set_dck(bool dck) {
-	static_cast<cxxrtl_design::p_twowire__dtm*>(dut)->p_dck.set<bool>(dck);
+	if (recorder)
+		recorder->set_dck(dck);
+	dut->set_dck(dck);
 }
 
 void tb::set_di(bool di) {
-	static_cast<cxxrtl_design::p_twowire__dtm*>(dut)->p_di.set<bool>(di);
+	if (recorder)
+		recorder->set_di(di);
+	dut->set_di(di);
 }
 
 bool tb::get_do() {
-	// Pulldown on bus, so return 0 if pin tristated.
-	return static_cast<cxxrtl_design::p_twowire__dtm*>(dut)->p_doe.get<bool>() ?
-		static_cast<cxxrtl_design::p_twowire__dtm*>(dut)->p_dout.get<bool>() : false;
+	// Pulldown on bus, so return 0 if all pins tristated.
+	bool dio = false;
+	for (unsigned int i = 0; i < dut->size(); ++i)
+		dio = dio || (dut->get_doe(i) && dut->get_dout(i));
+	if (recorder)
+		recorder->sample_do(dio);
+	return dio;
 }
 
-bool tb::get_stat_connected() {
-	return static_cast<cxxrtl_design::p_twowire__dtm*>(dut)->p_host__connected.get<bool>();
+bool tb::get_stat_connected(unsigned int instance) {
+	return dut->get_host_connected(instance);
 }
 
-void tb::step() {
-	cxxrtl_design::p_twowire__dtm *dtm = static_cast<cxxrtl_design::p_twowire__dtm*>(dut);
+void tb::set_reset(unsigned int instance, bool asserted) {
+	if (recorder)
+		recorder->set_reset(instance, asserted);
+	dut->set_drst_n(instance, !asserted);
+	if (asserted) {
+		bus[instance].last_read_response.delay_cycles = 0;
+		bus[instance].last_write_response.delay_cycles = 0;
+	}
+}
 
-	uint64_t bus_addr = dtm->p_dst__paddr.get<uint64_t>();
-	bool bus_setup_phase = dtm->p_dst__psel.get<bool>() && !dtm->p_dst__penable.get<bool>(); 
-	bool bus_wen = bus_setup_phase && dtm->p_dst__pwrite.get<bool>();
-	bool bus_ren = bus_setup_phase && !dtm->p_dst__pwrite.get<bool>();
-	uint32_t bus_wdata = dtm->p_dst__pwdata.get<uint32_t>();
+uint64_t tb::get_dck_cycles() {
+	return dck_cycles;
+}
+
+void tb::step() {
+	const unsigned int n = dut->size();
+	for (unsigned int i = 0; i < n; ++i) {
+		bus[i].addr = dut->get_paddr(i);
+		bool bus_setup_phase = dut->get_psel(i) && !dut->get_penable(i);
+		bus[i].wen = bus_setup_phase && dut->get_pwrite(i);
+		bus[i].ren = bus_setup_phase && !dut->get_pwrite(i);
+		bus[i].wdata = dut->get_pwdata(i);
+	}
 
-	dtm->step();
-	dtm->step();
-	vcd.sample(vcd_sample++);
-	waves_fd << vcd.buffer;
-	waves_fd.flush();
-	vcd.buffer.clear();
+	dut->eval();
+	dut->dump(vcd_sample++);
 
 	// Field bus accesses using testcase callbacks if available, and provide
 	// bus responses with correct timing based on callback results.
-	if (!dck_prev && dtm->p_dck.get<bool>()) {
-		dtm->p_dst__pslverr.set<bool>(0);
-		dtm->p_dst__pready.set<bool>(0);
-		if (last_read_response.delay_cycles > 0) {
-			--last_read_response.delay_cycles;
-			if (last_read_response.delay_cycles == 0) {
-				dtm->p_dst__prdata.set<uint32_t>(last_read_response.data);
-				dtm->p_dst__pslverr.set<bool>(last_read_response.err);
-				dtm->p_dst__pready.set<bool>(1);
+	if (!dck_prev && dut->get_dck()) {
+		++dck_cycles;
+		for (unsigned int i = 0; i < n; ++i) {
+			bus_read_response &last_read_response = bus[i].last_read_response;
+			bus_write_response &last_write_response = bus[i].last_write_response;
+			dut->set_pslverr(i, 0);
+			dut->set_pready(i, 0);
+			if (last_read_response.delay_cycles > 0) {
+				--last_read_response.delay_cycles;
+				if (last_read_response.delay_cycles == 0) {
+					dut->set_prdata(i, last_read_response.data);
+					dut->set_pslverr(i, last_read_response.err);
+					dut->set_pready(i, 1);
+				}
 			}
-		}
-		if (last_write_response.delay_cycles > 0) {
-			--last_write_response.delay_cycles;
-			if (last_write_response.delay_cycles == 0) {
-				dtm->p_dst__pslverr.set<bool>(last_write_response.err);
-				dtm->p_dst__pready.set<bool>(1);
+			if (last_write_response.delay_cycles > 0) {
+				--last_write_response.delay_cycles;
+				if (last_write_response.delay_cycles == 0) {
+					dut->set_pslverr(i, last_write_response.err);
+					dut->set_pready(i, 1);
+				}
+			}
+			if (bus[i].ren && read_callback) {
+				last_read_response = read_callback(bus[i].addr);
+				if (recorder)
+					recorder->bus_read(bus[i].addr, last_read_response);
+				// The callback is fielded in the setup phase. The response is
+				// presented from the next edge onward, so a delay of 0 is a
+				// zero-wait-state access phase.
+				last_read_response.delay_cycles++;
+			}
+			else if (bus[i].wen && write_callback) {
+				last_write_response = write_callback(bus[i].addr, bus[i].wdata);
+				if (recorder)
+					recorder->bus_write(bus[i].addr, bus[i].wdata, last_write_response);
+				last_write_response.delay_cycles++;
 			}
-		}
-		if (bus_ren && read_callback) {
-			last_read_response = read_callback(bus_addr);
-			// The test harness this was adapted from wasn't APB... consider
-			// this a TODO until there are tests covering the downstream bus.
-			last_read_response.delay_cycles++;
-
-			// if (last_read_response.delay_cycles == 0) {
-			// 	dtm->p_dst__prdata.set<uint32_t>(last_read_response.data);
-			// 	dtm->p_dst__pslverr.set<bool>(last_read_response.err);
-			// }
-			// else {
-			// 	dtm->p_dst__pready.set<bool>(0);
-			// }
-		}
-		else if (bus_wen && write_callback) {
-			last_write_response = write_callback(bus_addr, bus_wdata);
-			last_write_response.delay_cycles++;
-			// if (last_write_response.delay_cycles == 0) {
-			// 	dtm->p_dst__pslverr.set<bool>(last_write_response.err);
-			// }
-			// else {
-			// 	dtm->p_dst__pready.set<bool>(0);
-			// }
 		}
 	}
-	dck_prev = dtm->p_dck.get<bool>();
+	dck_prev = dut->get_dck();
+	if (recorder)
+		recorder->end_step(dck_cycles);
 }
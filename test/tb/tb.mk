@@ -0,0 +1,56 @@
+# Testbench build settings, shared by everything under test/ which links
+# against the testbench. Include this, then depend on $(TB_MAIN) and link
+# with $(TB_OBJS) $(TB_LDFLAGS). Outside tb/, this also supplies the rule
+# which rebuilds $(TB_MAIN) through tb/Makefile.
+#
+# BACKEND selects the simulation engine:
+#   cxxrtl    -- Yosys write_cxxrtl (default)
+#   verilator -- Verilator, with THREADS model threads
+#
+# WAVES selects the format of any waveform a testcase asks for:
+#   vcd -- plain VCD, written and flushed on every step (default)
+#   bin -- compact binary, encoded and written by a background thread. This
+#          is TWV with CXXRTL (convert with $(TB_DIR)/build/twv2vcd) and FST
+#          with Verilator.
+#
+# Each configuration builds into its own directory, so switching between them
+# doesn't force a rebuild.
+
+BACKEND ?= cxxrtl
+THREADS ?= 1
+WAVES   ?= vcd
+
+TB_DIR := $(patsubst %/,%,$(dir $(lastword $(MAKEFILE_LIST))))
+
+ifeq ($(WAVES),vcd)
+TB_WAVES_SUFFIX :=
+else ifeq ($(WAVES),bin)
+TB_WAVES_SUFFIX := -bin
+else
+$(error Unknown WAVES "$(WAVES)": expected vcd or bin)
+endif
+
+ifeq ($(BACKEND),cxxrtl)
+TB_CONFIG  := cxxrtl$(TB_WAVES_SUFFIX)
+TB_BUILD   := $(TB_DIR)/build/$(TB_CONFIG)
+TB_MAIN    := $(TB_BUILD)/tb.o
+TB_OBJS    := $(TB_MAIN)
+TB_LDFLAGS := -pthread
+else ifeq ($(BACKEND),verilator)
+TB_CONFIG  := verilator-t$(THREADS)$(TB_WAVES_SUFFIX)
+TB_BUILD   := $(TB_DIR)/build/$(TB_CONFIG)
+TB_MAIN    := $(TB_BUILD)/tb.o
+TB_OBJS    := $(TB_MAIN) $(TB_BUILD)/obj_dir/Vtwowire_dtm__ALL.a $(TB_BUILD)/obj_dir/libverilated.a
+TB_LDFLAGS := -pthread $(if $(TB_WAVES_SUFFIX),-lz)
+else
+$(error Unknown BACKEND "$(BACKEND)": expected cxxrtl or verilator)
+endif
+
+# Bit of a hack to trigger tb rebuild when verilog or testbench changes. This
+# mustn't become the includer's default goal.
+ifneq ($(abspath $(TB_DIR)),$(CURDIR))
+TB_SAVED_GOAL := $(.DEFAULT_GOAL)
+$(TB_MAIN): $(TB_DIR)/tb.cpp $(TB_DIR)/tb.mk $(wildcard $(TB_DIR)/*.h) $(TB_DIR)/../include/tb.h $(shell find $(TB_DIR)/../.. -name "*.v")
+	$(MAKE) -C $(TB_DIR)
+.DEFAULT_GOAL := $(TB_SAVED_GOAL)
+endif
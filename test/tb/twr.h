@@ -0,0 +1,190 @@
+#pragma once
+
+// TWR ("TwoWire recording") is a log of everything the host did to the
+// testbench, and every downstream bus response it served. The testbench
+// writes one when the TWD_RECORD environment variable names a file. Replaying
+// it through test/replay/ drives the design with exactly the same inputs,
+// with no host logic, and checks the design still does the same thing.
+//
+// Varints are unsigned LEB128, as in twv.h.
+//
+//   "TWR1"
+//   instance count
+//   events, until TWR_END:
+//     (steps since the previous event) << 4 | event type
+//     arguments, depending on the type (see below)
+//
+// Steps are calls to tb::step(). An event between two steps is stamped with
+// the number of steps before it, and a bus response with the number of steps
+// before the step that asked for it. DCK and DI only appear when they change.
+// DO appears every time the host samples it, as that is the output the host
+// acts on. Bus events also record what the design put on the bus, so that
+// replay can check it.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "tb.h"
+#include "twv.h"
+
+static const char TWR_MAGIC[4] = {'T', 'W', 'R', '1'};
+
+typedef enum {
+	TWR_DCK_LOW    = 0,
+	TWR_DCK_HIGH   = 1,
+	TWR_DI_LOW     = 2,
+	TWR_DI_HIGH    = 3,
+	TWR_DO_LOW     = 4,  // Host sampled DO
+	TWR_DO_HIGH    = 5,
+	TWR_RESET      = 6,  // instance << 1 | asserted
+	TWR_CALLBACKS  = 7,  // bit 0: read callback set, bit 1: write callback set
+	TWR_BUS_READ   = 8,  // addr, rdata, delay_cycles, err
+	TWR_BUS_WRITE  = 9,  // addr, wdata, delay_cycles, err
+	TWR_END        = 10  // DCK cycles
+} twr_event_type;
+
+class twr_writer {
+public:
+	twr_writer() : fd(nullptr), steps(0), last_step(0), dck(-1), di(-1), dck_cycles(0) {}
+	~twr_writer() {
+		close();
+	}
+
+	bool open(const std::string &filename, unsigned int n_instances) {
+		fd = fopen(filename.c_str(), "wb");
+		if (!fd)
+			return false;
+		buf.assign(TWR_MAGIC, TWR_MAGIC + sizeof(TWR_MAGIC));
+		twv_put_varint(buf, n_instances);
+		return true;
+	}
+
+	void set_dck(bool v) {
+		if (v != dck) {
+			dck = v;
+			event(v ? TWR_DCK_HIGH : TWR_DCK_LOW);
+		}
+	}
+
+	void set_di(bool v) {
+		if (v != di) {
+			di = v;
+			event(v ? TWR_DI_HIGH : TWR_DI_LOW);
+		}
+	}
+
+	void sample_do(bool v) {
+		event(v ? TWR_DO_HIGH : TWR_DO_LOW);
+	}
+
+	void set_reset(unsigned int instance, bool asserted) {
+		event(TWR_RESET);
+		twv_put_varint(buf, instance << 1 | asserted);
+	}
+
+	void set_callbacks(bool read, bool write) {
+		event(TWR_CALLBACKS);
+		twv_put_varint(buf, (unsigned)read | (unsigned)write << 1);
+	}
+
+	void bus_read(uint64_t addr, const bus_read_response &r) {
+		event(TWR_BUS_READ);
+		twv_put_varint(buf, addr);
+		twv_put_varint(buf, r.data);
+		twv_put_varint(buf, r.delay_cycles);
+		buf.push_back(r.err);
+	}
+
+	void bus_write(uint64_t addr, uint32_t wdata, const bus_write_response &r) {
+		event(TWR_BUS_WRITE);
+		twv_put_varint(buf, addr);
+		twv_put_varint(buf, wdata);
+		twv_put_varint(buf, r.delay_cycles);
+		buf.push_back(r.err);
+	}
+
+	void end_step(uint64_t dck_cycles_) {
+		++steps;
+		dck_cycles = dck_cycles_;
+		if (buf.size() >= (1u << 16))
+			flush();
+	}
+
+	// Called from the destructor, and by the testbench's exit handler so a
+	// failed tb_assert still leaves a complete log.
+	void close() {
+		if (!fd)
+			return;
+		event(TWR_END);
+		twv_put_varint(buf, dck_cycles);
+		flush();
+		fclose(fd);
+		fd = nullptr;
+	}
+
+private:
+	void event(twr_event_type type) {
+		twv_put_varint(buf, (steps - last_step) << 4 | type);
+		last_step = steps;
+	}
+
+	void flush() {
+		fwrite(buf.data(), 1, buf.size(), fd);
+		buf.clear();
+	}
+
+	FILE *fd;
+	std::vector<uint8_t> buf;
+	uint64_t steps;
+	uint64_t last_step;
+	int dck;
+	int di;
+	uint64_t dck_cycles;
+};
+
+struct twr_event {
+	uint64_t step;
+	twr_event_type type;
+	uint64_t args[4];
+};
+
+// Read a whole log. Returns false if the file can't be read, or stops before
+// TWR_END.
+static inline bool twr_read(const std::string &filename, unsigned int &n_instances, std::vector<twr_event> &events) {
+	FILE *f = fopen(filename.c_str(), "rb");
+	if (!f)
+		return false;
+	char magic[sizeof(TWR_MAGIC)];
+	uint64_t n = 0;
+	bool ok = fread(magic, 1, sizeof(magic), f) == sizeof(magic) && !memcmp(magic, TWR_MAGIC, sizeof(magic)) &&
+		twv_get_varint(f, n);
+	n_instances = n;
+	events.clear();
+	uint64_t step = 0;
+	while (ok) {
+		uint64_t tag;
+		ok = twv_get_varint(f, tag) && (tag & 0xfu) <= TWR_END;
+		if (!ok)
+			break;
+		twr_event e = {};
+		step += tag >> 4;
+		e.step = step;
+		e.type = (twr_event_type)(tag & 0xfu);
+		if (e.type == TWR_RESET || e.type == TWR_CALLBACKS || e.type == TWR_END) {
+			ok = twv_get_varint(f, e.args[0]);
+		} else if (e.type == TWR_BUS_READ || e.type == TWR_BUS_WRITE) {
+			int err = EOF;
+			ok = twv_get_varint(f, e.args[0]) && twv_get_varint(f, e.args[1]) &&
+				twv_get_varint(f, e.args[2]) && (err = fgetc(f)) != EOF;
+			e.args[3] = err;
+		}
+		events.push_back(e);
+		if (e.type == TWR_END)
+			break;
+	}
+	fclose(f);
+	return ok;
+}
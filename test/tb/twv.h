@@ -0,0 +1,64 @@
+#pragma once
+
+// TWV ("TwoWire waves") is the compact binary waveform format written by the
+// CXXRTL backend when built with WAVES=bin. Each sample only records the
+// signals which changed since the previous one. twv2vcd converts it back to
+// VCD for viewing.
+//
+// Every integer is an unsigned LEB128 varint. Strings are a length followed
+// by that many bytes.
+//
+//   "TWV1"
+//   timescale number, timescale unit (string)
+//   signal count, then for each signal:
+//     width, name (string), alias (0, or index + 1 of the signal it aliases)
+//   samples, until end of file:
+//     time since previous sample
+//     changes: signal index + 1, value as (width + 7) / 8 bytes, LSB first
+//     0
+//
+// Names use CXXRTL's space-separated hierarchy. Aliased signals never appear
+// in samples. The first sample contains every signal, and samples where
+// nothing changed are omitted. A file cut short by a crash is still readable
+// up to its last complete sample.
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+static const char TWV_MAGIC[4] = {'T', 'W', 'V', '1'};
+
+static inline void twv_put_varint(std::vector<uint8_t> &out, uint64_t x) {
+	while (x >= 0x80u) {
+		out.push_back((x & 0x7fu) | 0x80u);
+		x >>= 7;
+	}
+	out.push_back(x);
+}
+
+static inline void twv_put_string(std::vector<uint8_t> &out, const std::string &s) {
+	twv_put_varint(out, s.size());
+	out.insert(out.end(), s.begin(), s.end());
+}
+
+static inline bool twv_get_varint(FILE *f, uint64_t &x) {
+	x = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int c = fgetc(f);
+		if (c == EOF)
+			return false;
+		x |= (uint64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return true;
+	}
+	return false;
+}
+
+static inline bool twv_get_string(FILE *f, std::string &s) {
+	uint64_t len;
+	if (!twv_get_varint(f, len))
+		return false;
+	s.resize(len);
+	return len == 0 || fread(&s[0], 1, len, f) == len;
+}
@@ -0,0 +1,143 @@
+// Convert a TWV waveform (see twv.h) to VCD.
+//
+// Usage: twv2vcd in.twv [out.vcd]
+//
+// Writes to stdout if no output file is given.
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "twv.h"
+
+struct twv_signal {
+	uint64_t width;
+	std::string name;
+	std::string ident;
+};
+
+struct vcd_scope {
+	std::map<std::string, vcd_scope> children;
+	std::vector<std::pair<std::string, size_t>> vars; // leaf name, signal index
+};
+
+// Printable VCD identifier for each distinct signal
+static std::string vcd_ident(size_t n) {
+	std::string id;
+	do {
+		id.push_back('!' + n % 94);
+		n /= 94;
+	} while (n);
+	return id;
+}
+
+static void write_scope(FILE *out, const vcd_scope &scope, const std::vector<twv_signal> &signals) {
+	for (auto &var : scope.vars) {
+		const twv_signal &s = signals[var.second];
+		fprintf(out, "$var wire %llu %s %s $end\n", (unsigned long long)s.width, s.ident.c_str(), var.first.c_str());
+	}
+	for (auto &child : scope.children) {
+		fprintf(out, "$scope module %s $end\n", child.first.c_str());
+		write_scope(out, child.second, signals);
+		fprintf(out, "$upscope $end\n");
+	}
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "Usage: %s in.twv [out.vcd]\n", argv[0]);
+		return 1;
+	}
+	FILE *in = fopen(argv[1], "rb");
+	if (!in) {
+		perror(argv[1]);
+		return 1;
+	}
+	FILE *out = argc == 3 ? fopen(argv[2], "w") : stdout;
+	if (!out) {
+		perror(argv[2]);
+		return 1;
+	}
+
+	char magic[sizeof(TWV_MAGIC)];
+	uint64_t ts_number, n_signals;
+	std::string ts_unit;
+	if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) || memcmp(magic, TWV_MAGIC, sizeof(magic)) ||
+		!twv_get_varint(in, ts_number) || !twv_get_string(in, ts_unit) || !twv_get_varint(in, n_signals)) {
+		fprintf(stderr, "%s: not a TWV file\n", argv[1]);
+		return 1;
+	}
+
+	std::vector<twv_signal> signals(n_signals);
+	vcd_scope top;
+	size_t n_idents = 0;
+	for (size_t i = 0; i < n_signals; ++i) {
+		twv_signal &s = signals[i];
+		uint64_t alias_of;
+		if (!twv_get_varint(in, s.width) || !twv_get_string(in, s.name) || !twv_get_varint(in, alias_of) ||
+			alias_of > i) {
+			fprintf(stderr, "%s: bad signal table\n", argv[1]);
+			return 1;
+		}
+		s.ident = alias_of ? signals[alias_of - 1].ident : vcd_ident(n_idents++);
+
+		// CXXRTL hierarchy separator is a space
+		vcd_scope *scope = &top;
+		size_t start = 0, space;
+		while ((space = s.name.find(' ', start)) != std::string::npos) {
+			scope = &scope->children[s.name.substr(start, space - start)];
+			start = space + 1;
+		}
+		scope->vars.emplace_back(s.name.substr(start), i);
+	}
+
+	fprintf(out, "$timescale %llu %s $end\n", (unsigned long long)ts_number, ts_unit.c_str());
+	write_scope(out, top, signals);
+	fprintf(out, "$enddefinitions $end\n");
+
+	// Samples. Stop quietly at the first incomplete one, since the file may
+	// have been cut short.
+	uint64_t timestamp = 0;
+	std::vector<uint8_t> value;
+	std::string line;
+	for (;;) {
+		uint64_t delta;
+		if (!twv_get_varint(in, delta))
+			break;
+		timestamp += delta;
+		line = "#" + std::to_string(timestamp) + "\n";
+		bool complete = false;
+		uint64_t index;
+		while (twv_get_varint(in, index)) {
+			if (index == 0) {
+				complete = true;
+				break;
+			}
+			if (index > n_signals)
+				break;
+			const twv_signal &s = signals[index - 1];
+			value.resize((s.width + 7) / 8);
+			if (fread(value.data(), 1, value.size(), in) != value.size())
+				break;
+			if (s.width != 1)
+				line.push_back('b');
+			for (uint64_t bit = s.width; bit-- > 0;)
+				line.push_back('0' + (value[bit / 8] >> bit % 8 & 0x1u));
+			if (s.width != 1)
+				line.push_back(' ');
+			line += s.ident;
+			line.push_back('\n');
+		}
+		if (!complete)
+			break;
+		fputs(line.c_str(), out);
+	}
+
+	fclose(in);
+	if (out != stdout)
+		fclose(out);
+	return 0;
+}
@@ -0,0 +1,279 @@
+#pragma once
+
+// Binary waveform sink for the CXXRTL backend, with the same add()/sample()
+// usage as cxxrtl::vcd_writer. See twv.h for the file format.
+//
+// The simulation thread only compares each signal against its previous value
+// and copies changed values into a ring buffer. Encoding and file I/O happen
+// on a background thread. The simulation thread waits only if the ring
+// fills up, i.e. if the disk can't keep up at all.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
+#include <cxxrtl/cxxrtl.h>
+
+#include "twv.h"
+
+static_assert(sizeof(cxxrtl::chunk_t) == sizeof(uint32_t), "ring stores one chunk per word");
+
+// Lock-free single-producer single-consumer ring of 32-bit words. The
+// producer stages any number of words, then makes them visible to the
+// consumer all at once with publish().
+class twv_ring {
+public:
+	twv_ring(size_t min_words) : staged_tail(0), head(0), tail(0) {
+		size_t size = 1;
+		while (size < min_words)
+			size <<= 1;
+		buf.resize(size);
+		mask = size - 1;
+	}
+
+	// Producer side
+	size_t space() {
+		return buf.size() - (staged_tail - head.load(std::memory_order_acquire));
+	}
+	void push(uint32_t w) {
+		buf[staged_tail++ & mask] = w;
+	}
+	void publish() {
+		tail.store(staged_tail, std::memory_order_release);
+	}
+
+	// Consumer side: words [begin, end) are readable until release(end)
+	size_t begin() {
+		return head.load(std::memory_order_relaxed);
+	}
+	size_t end() {
+		return tail.load(std::memory_order_acquire);
+	}
+	uint32_t at(size_t pos) {
+		return buf[pos & mask];
+	}
+	void release(size_t pos) {
+		head.store(pos, std::memory_order_release);
+	}
+
+private:
+	std::vector<uint32_t> buf;
+	size_t mask;
+	size_t staged_tail;
+	// Keep head and tail on separate cache lines, so the two threads don't
+	// bounce one line between them. (Padding, not alignas, since C++14 new
+	// ignores extended alignment.)
+	char pad0[64];
+	std::atomic<size_t> head;
+	char pad1[64];
+	std::atomic<size_t> tail;
+};
+
+class twv_writer {
+public:
+	twv_writer() : fd(nullptr), ts_number(1), ts_unit("s"), total_chunks(0), started(false), stopping(false) {}
+	~twv_writer() {
+		close();
+	}
+
+	bool open(const std::string &filename) {
+		fd = fopen(filename.c_str(), "wb");
+		return fd != nullptr;
+	}
+
+	void timescale(unsigned int number, const std::string &unit) {
+		ts_number = number;
+		ts_unit = unit;
+	}
+
+	// Same selection as vcd_writer's default filter, except memories, which
+	// the DTM doesn't have.
+	void add(const cxxrtl::debug_items &items) {
+		for (auto &it : items.table) {
+			for (const cxxrtl::debug_item &part : it.second) {
+				if (part.type == cxxrtl::debug_item::MEMORY)
+					continue;
+				std::string name = it.first;
+				if (it.second.size() > 1)
+					name += "[" + std::to_string(part.lsb_at + part.width - 1) + ":" + std::to_string(part.lsb_at) + "]";
+				signal s;
+				s.name = name;
+				s.width = part.width;
+				s.chunks = (part.width + 31) / 32;
+				s.curr = part.curr;
+				s.alias_of = 0;
+				auto existing = signal_at.find(part.curr);
+				if (existing != signal_at.end()) {
+					s.alias_of = existing->second + 1;
+				} else {
+					signal_at[part.curr] = signals.size();
+					s.prev_offset = total_chunks;
+					total_chunks += s.chunks;
+				}
+				if (part.type == cxxrtl::debug_item::OUTLINE)
+					outlines.insert(part.outline);
+				signals.push_back(s);
+			}
+		}
+	}
+
+	void sample(uint64_t timestamp) {
+		if (!fd)
+			return;
+		if (!started)
+			start();
+		for (cxxrtl::debug_outline *o : outlines)
+			o->eval();
+		while (ring->space() < max_sample_words)
+			std::this_thread::yield();
+
+		bool any_changes = false;
+		for (uint32_t i = 0; i < signals.size(); ++i) {
+			const signal &s = signals[i];
+			if (s.alias_of)
+				continue;
+			cxxrtl::chunk_t *prev = &prev_values[s.prev_offset];
+			if (!first_sample && !memcmp(prev, s.curr, s.chunks * sizeof(cxxrtl::chunk_t)))
+				continue;
+			if (!any_changes) {
+				ring->push(RING_TIME);
+				ring->push((uint32_t)timestamp);
+				ring->push((uint32_t)(timestamp >> 32));
+				any_changes = true;
+			}
+			ring->push(i);
+			for (size_t c = 0; c < s.chunks; ++c) {
+				ring->push(s.curr[c]);
+				prev[c] = s.curr[c];
+			}
+		}
+		if (any_changes) {
+			ring->push(RING_END);
+			ring->publish();
+		}
+		first_sample = false;
+	}
+
+	// Drain the ring and close the file. Called from the destructor, and by
+	// the testbench's exit handler so waves survive a failed tb_assert.
+	void close() {
+		if (started) {
+			stopping.store(true, std::memory_order_release);
+			encoder.join();
+			started = false;
+		}
+		if (fd) {
+			fclose(fd);
+			fd = nullptr;
+		}
+	}
+
+private:
+	struct signal {
+		std::string name;
+		size_t width;
+		size_t chunks;
+		const cxxrtl::chunk_t *curr;
+		size_t prev_offset;
+		uint64_t alias_of;
+	};
+
+	// Ring record markers. Anything else is a signal index, followed by its
+	// value chunks.
+	static const uint32_t RING_TIME = 0xffffffffu; // then timestamp, LSW first
+	static const uint32_t RING_END  = 0xfffffffeu;
+
+	void start() {
+		std::vector<uint8_t> header(TWV_MAGIC, TWV_MAGIC + sizeof(TWV_MAGIC));
+		twv_put_varint(header, ts_number);
+		twv_put_string(header, ts_unit);
+		twv_put_varint(header, signals.size());
+		for (const signal &s : signals) {
+			twv_put_varint(header, s.width);
+			twv_put_string(header, s.name);
+			twv_put_varint(header, s.alias_of);
+		}
+		fwrite(header.data(), 1, header.size(), fd);
+
+		prev_values.resize(total_chunks);
+		max_sample_words = 4 + total_chunks + signals.size();
+		// Deep enough to ride out a few milliseconds of disk stall
+		ring.reset(new twv_ring(std::max<size_t>(1u << 20, 4 * max_sample_words)));
+		first_sample = true;
+		last_timestamp = 0;
+		stopping.store(false, std::memory_order_relaxed);
+		encoder = std::thread(&twv_writer::encode_loop, this);
+		started = true;
+	}
+
+	void encode_loop() {
+		std::vector<uint8_t> out;
+		out.reserve(1u << 17);
+		for (;;) {
+			// Check for stop before looking at the ring, so nothing published
+			// before close() is missed.
+			bool stop = stopping.load(std::memory_order_acquire);
+			size_t pos = ring->begin();
+			size_t end = ring->end();
+			if (pos == end) {
+				if (!out.empty()) {
+					fwrite(out.data(), 1, out.size(), fd);
+					fflush(fd);
+					out.clear();
+				}
+				if (stop)
+					return;
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+				continue;
+			}
+			while (pos != end) {
+				uint32_t w = ring->at(pos++);
+				if (w == RING_TIME) {
+					uint64_t t = ring->at(pos) | (uint64_t)ring->at(pos + 1) << 32;
+					pos += 2;
+					twv_put_varint(out, t - last_timestamp);
+					last_timestamp = t;
+				} else if (w == RING_END) {
+					out.push_back(0);
+				} else {
+					const signal &s = signals[w];
+					twv_put_varint(out, w + 1);
+					for (size_t byte = 0; byte < (s.width + 7) / 8; ++byte)
+						out.push_back(ring->at(pos + byte / 4) >> 8 * (byte % 4));
+					pos += s.chunks;
+				}
+			}
+			ring->release(pos);
+			if (out.size() >= (1u << 16)) {
+				fwrite(out.data(), 1, out.size(), fd);
+				out.clear();
+			}
+		}
+	}
+
+	FILE *fd;
+	unsigned int ts_number;
+	std::string ts_unit;
+	std::vector<signal> signals;
+	std::map<const cxxrtl::chunk_t*, size_t> signal_at;
+	std::set<cxxrtl::debug_outline*> outlines;
+	size_t total_chunks;
+
+	// Simulation thread only
+	std::vector<cxxrtl::chunk_t> prev_values;
+	size_t max_sample_words;
+	bool first_sample;
+
+	// Encoder thread only, once started
+	uint64_t last_timestamp;
+
+	std::unique_ptr<twv_ring> ring;
+	std::thread encoder;
+	bool started;
+	std::atomic<bool> stopping;
+};
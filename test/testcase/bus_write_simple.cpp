@@ -1,3 +1,5 @@
+#include <vector>
+
 #include "tb.h"
 #include "twd_util.h"
 
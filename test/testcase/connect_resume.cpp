@@ -0,0 +1,88 @@
+#include "tb.h"
+#include "twd_util.h"
+
+// Resume sequence:
+// - Reconnects after a parity error when CSR.RESUMEEN is set, clearing
+//   EPARITY and keeping the rest of CSR and ADDR
+// - Is ignored if RESUMEEN was clear at the time of the error
+// - Is ignored after a Disconnect command, or after a full Connect
+// - Does not stop a full Connect from working
+
+static void send_bad_command(tb &t) {
+	uint8_t bad_cmd_byte =
+		1u << 7 |
+		CMD_R_IDCODE << 3 |
+		1u << 2; // Parity fail
+	put_bits(t, &bad_cmd_byte, 8);
+}
+
+int main() {
+	tb t("waves.vcd");
+	connect_target(t, 0);
+	idle_clocks(t, 8);
+	tb_assert(t.get_stat_connected(), "Did not connect\n");
+
+	uint32_t csr;
+	const uint32_t ctrl = CSR_RESUMEEN_BITS | CSR_AINCR_BITS;
+	write_csr(t, ctrl);
+	tb_assert(read_csr(t, &csr), "Bad parity on CSR read\n");
+	tb_assert(csr & CSR_RESUMEEN_BITS, "CSR.RESUMEEN should be writable\n");
+	write_addr(t, 0x12345678u, 3);
+
+	// Parity error then Resume
+	send_bad_command(t);
+	tb_assert(!t.get_stat_connected(), "Did not disconnect on parity error\n");
+	resume_target(t, 0);
+	idle_clocks(t, 1);
+	tb_assert(t.get_stat_connected(), "Did not resume\n");
+	tb_assert(read_csr(t, &csr), "Bad parity on CSR read after resume\n");
+	tb_assert(!(csr & CSR_EPARITY_BITS), "CSR.EPARITY should be cleared by resume\n");
+	tb_assert((csr & (CSR_RESUMEEN_BITS | CSR_AINCR_BITS)) == ctrl, "CSR control bits lost on resume\n");
+	tb_assert(read_addr(t, 3) == 0x12345678u, "ADDR lost on resume\n");
+
+	// Can't resume twice from one error
+	send_command_byte(t, CMD_DISCONNECT);
+	resume_target(t, 0);
+	idle_clocks(t, 1);
+	tb_assert(!t.get_stat_connected(), "Resumed without a parity error\n");
+
+	// Full Connect clears resumable state. Drop the link afterward with a
+	// parity error while RESUMEEN is clear, which leaves resumable state as
+	// it was, rather than with a Disconnect command, which would clear it.
+	connect_target(t, 0);
+	send_bad_command(t);
+	connect_target(t, 0);
+	idle_clocks(t, 1);
+	tb_assert(t.get_stat_connected(), "Full connect failed while resumable\n");
+	tb_assert(read_csr(t, &csr), "Bad parity on CSR read\n");
+	tb_assert(csr & CSR_EPARITY_BITS, "CSR.EPARITY should still be set after a full Connect\n");
+	write_csr(t, CSR_EPARITY_BITS | CSR_AINCR_BITS);
+	send_bad_command(t);
+	tb_assert(!t.get_stat_connected(), "Did not disconnect on parity error\n");
+	resume_target(t, 0);
+	idle_clocks(t, 1);
+	tb_assert(!t.get_stat_connected(), "Resumed after a full Connect\n");
+
+	// Wrong address doesn't resume
+	connect_target(t, 0);
+	write_csr(t, CSR_EPARITY_BITS | ctrl);
+	send_bad_command(t);
+	resume_target(t, 1);
+	idle_clocks(t, 1);
+	tb_assert(!t.get_stat_connected(), "Resumed at wrong address\n");
+	resume_target(t, 0);
+	idle_clocks(t, 1);
+	tb_assert(t.get_stat_connected(), "Did not resume after a mismatched Resume\n");
+
+	// No resume when RESUMEEN is clear
+	write_csr(t, CSR_EPARITY_BITS);
+	send_bad_command(t);
+	resume_target(t, 0);
+	idle_clocks(t, 1);
+	tb_assert(!t.get_stat_connected(), "Resumed with RESUMEEN clear\n");
+	connect_target(t, 0);
+	idle_clocks(t, 1);
+	tb_assert(t.get_stat_connected(), "Did not reconnect\n");
+
+	return 0;
+}
@@ -0,0 +1,72 @@
+#include "tb.h"
+#include "twd_util.h"
+#include "twd_multidrop.h"
+
+// Put three DTMs on one bus, assign their multidrop addresses by releasing
+// them from reset one at a time, then check that enumeration finds exactly
+// those three and identifies them correctly, with and without the R.STAT
+// probe. The address 0 target is not the last instance, so
+// assign_mdropaddrs() has to reorder the releases.
+
+int main() {
+	const unsigned int n_targets = 3;
+	const uint8_t addrs[n_targets] = {5, 0, 11};
+	tb t("waves.vcd", n_targets);
+
+	assign_mdropaddrs(t, addrs, n_targets);
+	for (unsigned int i = 0; i < n_targets; ++i)
+		tb_assert(!t.get_stat_connected(i), "Instance %u still connected after address assignment\n", i);
+
+	twd_target_info inventory[N_MDROPADDR];
+	uint64_t start_cycles = t.get_dck_cycles();
+	unsigned int n_found = enumerate_targets(t, inventory);
+	uint64_t cycles = t.get_dck_cycles() - start_cycles;
+	printf("Found %u targets in %llu cycles\n", n_found, (unsigned long long)cycles);
+	tb_assert(n_found == n_targets, "Expected %u targets, found %u\n", n_targets, n_found);
+	// Connect, R.IDCODE, R.CSR and Disconnect at every address
+	const uint64_t stream_cycles = N_MDROPADDR * (152 + 44 + 44 + 8);
+	tb_assert(cycles == stream_cycles, "Enumeration took %llu cycles, expected %llu\n",
+		(unsigned long long)cycles, (unsigned long long)stream_cycles);
+
+	// Three targets is sparse enough for the R.STAT probe to pay off
+	twd_target_info sparse_inventory[N_MDROPADDR];
+	start_cycles = t.get_dck_cycles();
+	n_found = enumerate_targets(t, sparse_inventory, true);
+	cycles = t.get_dck_cycles() - start_cycles;
+	printf("Found %u targets in %llu cycles with R.STAT probe\n", n_found, (unsigned long long)cycles);
+	tb_assert(n_found == n_targets, "Expected %u targets with R.STAT probe, found %u\n", n_targets, n_found);
+	const uint64_t sparse_cycles = N_MDROPADDR * (152 + 16 + 8) + n_targets * (152 + 44 + 44 + 8);
+	tb_assert(cycles == sparse_cycles && sparse_cycles < stream_cycles,
+		"Enumeration with R.STAT probe took %llu cycles, expected %llu\n",
+		(unsigned long long)cycles, (unsigned long long)sparse_cycles);
+	for (unsigned int addr = 0; addr < N_MDROPADDR; ++addr) {
+		tb_assert(sparse_inventory[addr].present == inventory[addr].present &&
+			sparse_inventory[addr].idcode == inventory[addr].idcode &&
+			sparse_inventory[addr].csr == inventory[addr].csr, "Inventories differ at address %u\n", addr);
+	}
+
+	for (unsigned int addr = 0; addr < N_MDROPADDR; ++addr) {
+		bool expect_present = false;
+		for (unsigned int i = 0; i < n_targets; ++i)
+			expect_present = expect_present || addrs[i] == addr;
+		tb_assert(inventory[addr].present == expect_present, "Wrong presence at address %u\n", addr);
+		if (!expect_present)
+			continue;
+		printf("%2u: IDCODE %08x CSR %08x\n", addr, inventory[addr].idcode, inventory[addr].csr);
+		tb_assert(inventory[addr].idcode == 0xdeadbeefu, "Bad IDCODE at address %u\n", addr);
+		tb_assert((inventory[addr].csr & CSR_MDROPADDR_BITS) >> CSR_MDROPADDR_LSB == addr,
+			"CSR.MDROPADDR doesn't match address %u\n", addr);
+		tb_assert((inventory[addr].csr & CSR_ASIZE_BITS) >> CSR_ASIZE_LSB == 3, "Bad ASIZE at address %u\n", addr);
+	}
+
+	for (unsigned int i = 0; i < n_targets; ++i)
+		tb_assert(!t.get_stat_connected(i), "Instance %u still connected after enumeration\n", i);
+
+	// Bus should still be usable afterward
+	connect_target(t, 11);
+	idle_clocks(t, 1);
+	tb_assert(t.get_stat_connected(2), "Could not connect to address 11\n");
+	tb_assert(!t.get_stat_connected(0) && !t.get_stat_connected(1), "Wrong target connected\n");
+
+	return 0;
+}
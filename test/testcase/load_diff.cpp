@@ -0,0 +1,205 @@
+#include <elf.h>
+#include <unistd.h>
+
+#include "tb.h"
+#include "twd_util.h"
+#include "twd_loader.h"
+
+// Load an ELF image with twd_loader, then reload it after small changes, and
+// check that only the changed pages are written. Also check that target
+// memory changed behind the manifest's back is caught by the readback, that
+// images at different addresses share the manifest, and that a bus fault
+// fails the load and drops only that image's pages from the manifest.
+
+static const unsigned int MEM_WORDS = 1u << 16;
+uint32_t mem[MEM_WORDS];
+bool fault_enable;
+uint64_t fault_addr;
+unsigned int bus_writes;
+
+bus_read_response read_callback(uint64_t addr) {
+	return {
+		.data = mem[addr % MEM_WORDS],
+		.delay_cycles = 0,
+		.err = false
+	};
+}
+
+bus_write_response write_callback(uint64_t addr, uint32_t data) {
+	if (fault_enable && addr == fault_addr) {
+		return {
+			.delay_cycles = 0,
+			.err = true
+		};
+	}
+	++bus_writes;
+	mem[addr % MEM_WORDS] = data;
+	return {
+		.delay_cycles = 0,
+		.err = false
+	};
+}
+
+struct test_segment {
+	uint32_t addr;
+	std::vector<uint8_t> data;
+};
+
+// Segments in a minimal little-endian ELF32
+static void write_elf(const char *filename, const std::vector<test_segment> &segs) {
+	Elf32_Ehdr eh = {};
+	memcpy(eh.e_ident, ELFMAG, SELFMAG);
+	eh.e_ident[EI_CLASS] = ELFCLASS32;
+	eh.e_ident[EI_DATA] = ELFDATA2LSB;
+	eh.e_ident[EI_VERSION] = EV_CURRENT;
+	eh.e_type = ET_EXEC;
+	eh.e_machine = EM_RISCV;
+	eh.e_version = EV_CURRENT;
+	eh.e_phoff = sizeof(eh);
+	eh.e_ehsize = sizeof(eh);
+	eh.e_phentsize = sizeof(Elf32_Phdr);
+	eh.e_phnum = segs.size();
+	FILE *f = fopen(filename, "wb");
+	tb_assert(f, "Couldn't create %s\n", filename);
+	fwrite(&eh, sizeof(eh), 1, f);
+	uint32_t offs = sizeof(eh) + segs.size() * sizeof(Elf32_Phdr);
+	for (const test_segment &s : segs) {
+		Elf32_Phdr ph = {};
+		ph.p_type = PT_LOAD;
+		ph.p_offset = offs;
+		ph.p_vaddr = s.addr;
+		ph.p_paddr = s.addr;
+		ph.p_filesz = s.data.size();
+		ph.p_memsz = s.data.size() + 64;
+		ph.p_flags = PF_R | PF_W | PF_X;
+		fwrite(&ph, sizeof(ph), 1, f);
+		offs += s.data.size();
+	}
+	for (const test_segment &s : segs)
+		fwrite(s.data.data(), 1, s.data.size(), f);
+	fclose(f);
+}
+
+static void check_mem(const std::vector<test_segment> &segs) {
+	for (const test_segment &s : segs) {
+		for (size_t i = 0; i < s.data.size(); ++i) {
+			uint32_t addr = s.addr + i;
+			uint8_t byte = mem[addr / 4 % MEM_WORDS] >> 8 * (addr % 4);
+			tb_assert(byte == s.data[i], "Bad byte at %08x: %02x, expected %02x\n", addr, byte, s.data[i]);
+		}
+	}
+}
+
+static void load_and_report(twd_loader &l, const char *filename, const char *what, bool force_full = false) {
+	twd_image img;
+	tb_assert(img.open(filename), "Couldn't open %s\n", filename);
+	tb_assert(l.load(img, force_full), "%s: load failed\n", what);
+	const twd_load_stats &s = l.stats;
+	printf("%s: %llu of %llu pages written, %llu bytes skipped, %llu stale, %llu DCK cycles (%llu saved)\n",
+		what, (unsigned long long)s.pages_written, (unsigned long long)s.pages_total,
+		(unsigned long long)s.bytes_skipped, (unsigned long long)s.pages_stale,
+		(unsigned long long)s.dck_cycles, (unsigned long long)(s.dck_cycles_full - s.dck_cycles));
+}
+
+int main() {
+	tb t("waves.vcd");
+	t.set_bus_read_callback(read_callback);
+	t.set_bus_write_callback(write_callback);
+
+	// 1 KiB pages. Text covers 16 pages plus a partial word; data starts
+	// part-way into a page.
+	std::vector<test_segment> segs = {
+		{0x0000, std::vector<uint8_t>(16 * 1024 + 102)},
+		{0x8100, std::vector<uint8_t>(3000)}
+	};
+	uint32_t x = 1;
+	for (test_segment &s : segs) {
+		for (uint8_t &b : s.data) {
+			x = x * 1103515245u + 12345u;
+			b = x >> 16;
+		}
+	}
+	write_elf("build/load_diff.elf", segs);
+
+	connect_target(t, 0);
+	// Error clears must write these back, not release the held reset
+	write_csr(t, CSR_RESUMEEN_BITS | CSR_NDTMRESET_BITS);
+	twd_loader l(t, "build");
+	remove(l.get_manifest_path().c_str());
+
+	printf("Initial load\n");
+	load_and_report(l, "build/load_diff.elf", "initial");
+	check_mem(segs);
+	// 17 text pages, and data at words 0x2040..0x232e covers 4
+	tb_assert(l.stats.pages_total == 21, "Expected 21 pages, got %llu\n", (unsigned long long)l.stats.pages_total);
+	tb_assert(l.stats.pages_written == 21 && l.stats.bytes_skipped == 0, "Everything should be written\n");
+	tb_assert(l.stats.dck_cycles == l.stats.dck_cycles_full, "Full-load estimate %llu doesn't match %llu\n",
+		(unsigned long long)l.stats.dck_cycles_full, (unsigned long long)l.stats.dck_cycles);
+
+	printf("Identical reload\n");
+	bus_writes = 0;
+	load_and_report(l, "build/load_diff.elf", "identical");
+	tb_assert(l.stats.pages_written == 0 && bus_writes == 0, "Nothing should be written\n");
+	tb_assert(l.stats.bytes_skipped == l.stats.bytes_total, "Everything should be skipped\n");
+	tb_assert(l.stats.dck_cycles * 50 < l.stats.dck_cycles_full, "Reload should be much cheaper\n");
+
+	printf("Reload with one changed page\n");
+	segs[0].data[5 * 1024 + 17] ^= 0xffu;
+	write_elf("build/load_diff.elf", segs);
+	bus_writes = 0;
+	load_and_report(l, "build/load_diff.elf", "changed");
+	check_mem(segs);
+	tb_assert(l.stats.pages_written == 1 && bus_writes == 256, "Only the changed page should be written\n");
+
+	printf("Reload with the target's copy of a page overwritten\n");
+	for (unsigned int i = 0; i < 256; ++i)
+		mem[9 * 256 + i] = 0;
+	load_and_report(l, "build/load_diff.elf", "scribbled");
+	check_mem(segs);
+	tb_assert(l.stats.pages_stale == 1 && l.stats.pages_written == 1, "Overwritten page should be rewritten\n");
+
+	printf("Forced full reload\n");
+	load_and_report(l, "build/load_diff.elf", "forced", true);
+	tb_assert(l.stats.pages_written == 21, "Forced load should write everything\n");
+
+	printf("Flat binary\n");
+	FILE *f = fopen("build/load_diff.bin", "wb");
+	tb_assert(f, "Couldn't create flat binary\n");
+	fwrite(segs[1].data.data(), 1, segs[1].data.size(), f);
+	fclose(f);
+	twd_image flat;
+	tb_assert(flat.open("build/load_diff.bin", 0x10000), "Couldn't open flat binary\n");
+	tb_assert(flat.segments.size() == 1 && flat.segments[0].size == 3000, "Bad flat image\n");
+	tb_assert(l.load(flat), "Flat load failed\n");
+	tb_assert(l.stats.pages_written == 3, "Flat load should write 3 pages\n");
+	check_mem({{0x10000, segs[1].data}});
+
+	printf("Reload after loading elsewhere\n");
+	bus_writes = 0;
+	load_and_report(l, "build/load_diff.elf", "elsewhere");
+	tb_assert(l.stats.pages_written == 0 && bus_writes == 0, "ELF pages should survive the flat load\n");
+
+	printf("Bus fault\n");
+	segs[1].data[0] ^= 0xffu;
+	write_elf("build/load_diff.elf", segs);
+	twd_image img;
+	tb_assert(img.open("build/load_diff.elf"), "Couldn't reopen ELF\n");
+	fault_enable = true;
+	fault_addr = 0x8100 / 4;
+	tb_assert(!l.load(img), "Load should fail on bus fault\n");
+	tb_assert(access(l.get_manifest_path().c_str(), F_OK) == 0, "Manifest should be kept\n");
+	uint32_t csr;
+	tb_assert(read_csr(t, &csr), "Bad parity on CSR read\n");
+	tb_assert(!(csr & CSR_ERR_BITS), "Errors not cleared: CSR %08x\n", csr);
+	tb_assert((csr & CSR_CTRL_BITS) == (CSR_RESUMEEN_BITS | CSR_AINCR_BITS | CSR_NDTMRESET_BITS),
+		"Control fields not preserved: CSR %08x\n", csr);
+	fault_enable = false;
+	tb_assert(l.load(img), "Load should succeed after fault is removed\n");
+	tb_assert(l.stats.pages_written == 21, "Load after failure should write everything\n");
+	check_mem(segs);
+	bus_writes = 0;
+	tb_assert(l.load(flat), "Flat reload failed\n");
+	tb_assert(l.stats.pages_written == 0 && bus_writes == 0, "Flat pages should survive the failed load\n");
+
+	return 0;
+}
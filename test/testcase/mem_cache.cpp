@@ -0,0 +1,155 @@
+#include "tb.h"
+#include "twd_util.h"
+#include "twd_mem.h"
+
+// Check twd_mem against a simple downstream memory: repeated reads are
+// served from the cache, adjacent and overlapping reads in a batch share one
+// burst, gaps are only read through when asked for and are never cached,
+// writes invalidate cached words, a failed batch reads as zeroes, and
+// invalidate() hands the DTM back after something else has used it.
+
+static const unsigned int MEM_SIZE = 256;
+uint32_t mem[MEM_SIZE];
+unsigned int bus_reads;
+bool fault_enable;
+uint64_t fault_addr;
+
+bus_read_response read_callback(uint64_t addr) {
+	++bus_reads;
+	return {
+		.data = mem[addr % MEM_SIZE],
+		.delay_cycles = 0,
+		.err = fault_enable && addr == fault_addr
+	};
+}
+
+bus_write_response write_callback(uint64_t addr, uint32_t data) {
+	mem[addr % MEM_SIZE] = data;
+	return {
+		.delay_cycles = 0,
+		.err = false
+	};
+}
+
+int main() {
+	tb t("waves.vcd");
+	t.set_bus_read_callback(read_callback);
+	t.set_bus_write_callback(write_callback);
+	for (unsigned int i = 0; i < MEM_SIZE; ++i)
+		mem[i] = i * 0x01010101u ^ 0xa5000000u;
+
+	connect_target(t, 0);
+	write_csr(t, CSR_RESUMEEN_BITS);
+	twd_mem m(t);
+	uint32_t csr;
+	tb_assert(read_csr(t, &csr), "Bad parity on CSR read\n");
+	tb_assert((csr & (CSR_RESUMEEN_BITS | CSR_AINCR_BITS)) == (CSR_RESUMEEN_BITS | CSR_AINCR_BITS),
+		"twd_mem should only set AINCR: CSR %08x\n", csr);
+
+	uint32_t buf[16];
+	tb_assert(m.read(0x10, buf, 8), "Read failed\n");
+	for (unsigned int i = 0; i < 8; ++i)
+		tb_assert(buf[i] == mem[0x10 + i], "Bad data at %u: %08x\n", i, buf[i]);
+	tb_assert(m.stats.read_bursts == 1, "Expected one burst, got %llu\n", (unsigned long long)m.stats.read_bursts);
+
+	printf("Repeated read\n");
+	unsigned int reads_before = bus_reads;
+	uint64_t cycles_before = t.get_dck_cycles();
+	tb_assert(m.read(0x12, buf, 4), "Read failed\n");
+	tb_assert(bus_reads == reads_before, "Cached words should not be re-read\n");
+	tb_assert(t.get_dck_cycles() == cycles_before, "Cache hit should cost no DCK cycles\n");
+	for (unsigned int i = 0; i < 4; ++i)
+		tb_assert(buf[i] == mem[0x12 + i], "Bad cached data at %u\n", i);
+
+	printf("Coalesced batch\n");
+	uint32_t a[4], b[4], c[2];
+	twd_mem_range batch[3] = {
+		{0x44, 4, b},  // Adjacent to a
+		{0x40, 4, a},
+		{0x46, 2, c}   // Overlaps b
+	};
+	uint64_t bursts_before = m.stats.read_bursts;
+	tb_assert(m.read_batch(batch, 3), "Batch read failed\n");
+	tb_assert(m.stats.read_bursts == bursts_before + 1, "Batch should be one burst\n");
+	for (unsigned int i = 0; i < 4; ++i) {
+		tb_assert(a[i] == mem[0x40 + i], "Bad data in a[%u]\n", i);
+		tb_assert(b[i] == mem[0x44 + i], "Bad data in b[%u]\n", i);
+	}
+	tb_assert(c[0] == mem[0x46] && c[1] == mem[0x47], "Bad data in c\n");
+
+	printf("Gap between requests\n");
+	uint32_t d[2], e[2];
+	twd_mem_range gapped[2] = {
+		{0x60, 2, d},
+		{0x63, 2, e}  // One word gap
+	};
+	bursts_before = m.stats.read_bursts;
+	reads_before = bus_reads;
+	tb_assert(m.read_batch(gapped, 2), "Batch read failed\n");
+	tb_assert(m.stats.read_bursts == bursts_before + 2, "Gap should not be read through by default\n");
+	tb_assert(bus_reads == reads_before + 4, "Only requested words should be read\n");
+
+	printf("Write invalidates\n");
+	uint32_t wdata[2] = {0x12345678u, 0x9abcdef0u};
+	tb_assert(m.write(0x13, wdata, 2), "Write failed\n");
+	tb_assert(mem[0x13] == wdata[0] && mem[0x14] == wdata[1], "Write did not reach memory\n");
+	reads_before = bus_reads;
+	tb_assert(m.read(0x12, buf, 4), "Read failed\n");
+	tb_assert(bus_reads == reads_before + 2, "Expected only the written words to be re-read\n");
+	tb_assert(buf[1] == wdata[0] && buf[2] == wdata[1], "Stale data after write\n");
+	tb_assert(buf[0] == mem[0x12] && buf[3] == mem[0x15], "Bad data around write\n");
+
+	printf("Overlapping write batch\n");
+	uint32_t w0[3] = {1, 2, 3};
+	uint32_t w1[2] = {4, 5};
+	twd_mem_range wbatch[2] = {
+		{0x80, 3, w0},
+		{0x82, 2, w1}  // Later write wins at 0x82
+	};
+	uint64_t wbursts_before = m.stats.write_bursts;
+	tb_assert(m.write_batch(wbatch, 2), "Batch write failed\n");
+	tb_assert(m.stats.write_bursts == wbursts_before + 1, "Write batch should be one burst\n");
+	tb_assert(mem[0x80] == 1 && mem[0x81] == 2 && mem[0x82] == 4 && mem[0x83] == 5, "Bad write batch result\n");
+
+	printf("Gap read-through\n");
+	twd_mem mg(t, 1024, true);
+	gapped[0].addr = 0x70;
+	gapped[1].addr = 0x73;
+	reads_before = bus_reads;
+	tb_assert(mg.read_batch(gapped, 2), "Batch read failed\n");
+	tb_assert(mg.stats.read_bursts == 1, "Gap should be read through with read_gaps\n");
+	tb_assert(bus_reads == reads_before + 5, "Expected 5 words read, got %u\n", bus_reads - reads_before);
+	tb_assert(d[0] == mem[0x70] && d[1] == mem[0x71] && e[0] == mem[0x73] && e[1] == mem[0x74], "Bad gapped data\n");
+	reads_before = bus_reads;
+	tb_assert(mg.read(0x72, buf, 1), "Read failed\n");
+	tb_assert(bus_reads == reads_before + 1, "Gap words should not be cached\n");
+	// mg has moved ADDR behind m's back
+	m.invalidate();
+
+	printf("ADDR moved by another user\n");
+	uint32_t w2[2] = {6, 7};
+	uint32_t w3[1] = {8};
+	tb_assert(m.write(0xa0, w2, 2), "Write failed\n");
+	tb_assert(mg.write(0xb0, w3, 1), "Write failed\n");
+	m.invalidate();
+	tb_assert(m.write(0xa2, w2, 2), "Write failed\n");
+	tb_assert(mem[0xa2] == 6 && mem[0xa3] == 7, "Write after invalidate() went astray\n");
+	tb_assert(mem[0xb1] == (0xb1u * 0x01010101u ^ 0xa5000000u), "Write landed where the other user left ADDR\n");
+
+	printf("Failed batch\n");
+	fault_enable = true;
+	fault_addr = 0x91;
+	for (unsigned int i = 0; i < 4; ++i)
+		buf[i] = 0xffffffffu;
+	tb_assert(!m.read(0x90, buf, 4), "Read should fail on bus fault\n");
+	tb_assert(m.get_last_error_csr() & CSR_EBUSFAULT_BITS, "Expected EBUSFAULT\n");
+	for (unsigned int i = 0; i < 4; ++i)
+		tb_assert(buf[i] == 0, "Failed read should return zeroes, got %08x at %u\n", buf[i], i);
+	fault_enable = false;
+	tb_assert(m.read(0x90, buf, 4), "Read should succeed once the fault is removed\n");
+	tb_assert(buf[1] == mem[0x91], "Bad data after fault\n");
+	tb_assert(read_csr(t, &csr), "Bad parity on CSR read\n");
+	tb_assert(csr & CSR_RESUMEEN_BITS, "Error clear should preserve RESUMEEN: CSR %08x\n", csr);
+
+	return 0;
+}
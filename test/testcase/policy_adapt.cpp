@@ -0,0 +1,96 @@
+#include <vector>
+
+#include "tb.h"
+#include "twd_util.h"
+#include "twd_policy.h"
+
+// Write through twd_policy to a downstream bus with varying latency and
+// fault rate. Every word must land, whatever the policy decides, and the
+// policy should settle on the mode its cost model makes cheapest at the
+// extremes. Exact batch lengths and cycle counts aren't checked, apart
+// from the longest batch on a bus which never fails.
+
+static const unsigned int MEM_WORDS = 4096;
+
+uint32_t mem[MEM_WORDS];
+int bus_delay = 0;
+unsigned int fault_per_1024 = 0;
+uint32_t rng_state = 1;
+
+static uint32_t rng() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+bus_write_response write_callback(uint64_t addr, uint32_t data) {
+	bool fault = rng() % 1024 < fault_per_1024;
+	if (!fault && addr < MEM_WORDS)
+		mem[addr] = data;
+	return {
+		.delay_cycles = bus_delay,
+		.err = fault
+	};
+}
+
+static void run_and_check(twd_policy &p, uint64_t base, unsigned int n) {
+	uint64_t sent_before = p.stats.words_sent;
+	uint64_t written_before = p.stats.words_written;
+	std::vector<uint32_t> data(n);
+	for (unsigned int i = 0; i < n; ++i)
+		data[i] = (base + i) * 0x9e3779b9u;
+	tb_assert(p.write(base, data.data(), n), "Write failed\n");
+	for (unsigned int i = 0; i < n; ++i)
+		tb_assert(mem[base + i] == data[i], "Mismatch at %u: %08x vs %08x\n", (unsigned)(base + i), mem[base + i], data[i]);
+	tb_assert(p.stats.words_written - written_before == n, "Expected %u words written\n", n);
+	tb_assert(p.stats.words_sent - sent_before >= n, "Fewer words sent than written\n");
+	printf("delay %3d faults %2u/1024: mode %s, batch %2u, busy %.3f, fault %.3f, %llu words sent\n",
+		bus_delay, fault_per_1024, p.get_mode() == POLL_STAT ? "stat    " : "deferred",
+		p.get_batch_len(), p.get_busy_rate(), p.get_fault_rate(), (unsigned long long)p.stats.words_sent);
+}
+
+int main() {
+	tb t("waves.vcd");
+	t.set_bus_write_callback(write_callback);
+	connect_target(t, 0);
+	// Error clears must write these back, not release the held reset
+	write_csr(t, CSR_RESUMEEN_BITS | CSR_NDTMRESET_BITS);
+	const unsigned int max_batch = 64;
+	twd_policy p(t, max_batch);
+
+	// Fast, reliable bus: with no errors, deferred cost only falls as the
+	// batch grows, so the policy doubles up to max_batch, and nothing is
+	// ever resent.
+	run_and_check(p, 0, 512);
+	tb_assert(p.get_mode() == POLL_DEFERRED, "Should defer checks on a fast bus\n");
+	tb_assert(p.get_batch_len() == max_batch, "Should use the longest batch on a fast bus\n");
+	tb_assert(p.stats.words_sent == 512, "Nothing should be resent on a reliable bus\n");
+
+	// Slow bus: back-to-back W.DATA would always be EBUSY
+	bus_delay = 100;
+	run_and_check(p, 512, 512);
+	tb_assert(p.get_mode() == POLL_STAT, "Should poll R.STAT on a slow bus\n");
+
+	// Back to fast, but faulty: deferred, with shorter batches
+	bus_delay = 0;
+	fault_per_1024 = 40;
+	run_and_check(p, 1024, 2048);
+	tb_assert(p.get_mode() == POLL_DEFERRED, "Should return to deferred checks on a fast bus\n");
+	tb_assert(p.get_batch_len() < max_batch, "Should shrink batches when faults are frequent\n");
+	tb_assert(p.stats.fault_errors > 0, "Expected some faults\n");
+
+	// A word which always faults fails the write, and leaves the DTM usable
+	fault_per_1024 = 1024;
+	uint32_t w = 0;
+	tb_assert(!p.write(3072, &w, 1), "Persistent fault should fail the write\n");
+	fault_per_1024 = 0;
+	run_and_check(p, 3072, 64);
+
+	uint32_t csr;
+	tb_assert(read_csr(t, &csr), "Bad parity on CSR read\n");
+	uint32_t ctrl = CSR_RESUMEEN_BITS | CSR_AINCR_BITS | CSR_NDTMRESET_BITS;
+	tb_assert((csr & CSR_CTRL_BITS) == ctrl, "Control fields not preserved: CSR %08x\n", csr);
+
+	return 0;
+}